@@ -1,17 +1,53 @@
 #ifndef MPU6000_h
 #define MPU6000_h
 
+#include <stdint.h>
+
+#include "robot_driver/spiTransport.h"
+
+// One burst of the sensor registers from ACCEL_XOUT_H to GYRO_ZOUT_L
+struct mpu6000_sample
+{
+  int16_t raw_acc[3];
+  int16_t raw_temp;
+  int16_t raw_rot[3];
+
+  float acc[3]; // Gs
+  float temp;   // °C
+  float rot[3]; // Degrees per second
+};
+
+// Registers init() and the scale setters configure, enough to tell whether a chip is still set up
+struct mpu6000_config
+{
+  unsigned char smplrt_div;
+  unsigned char config;
+  unsigned char gyro_config;
+  unsigned char accel_config;
+  unsigned char pwr_mgmt_1;
+};
+
 class mpu6000
 {
   public:
-    mpu6000(int csChannel, long speed);
+    mpu6000(spiTransport &spi);
 
     bool init(int sample_rate_div,int low_pass_filter);
     void wakeup();
+    mpu6000_config read_config();
+    bool resume(const mpu6000_config &expected);
 
     float read_acc(int axis);
     float read_rot(int axis);
     float read_temp();
+    mpu6000_sample read_all();
+
+    void enable_fifo();
+    void reset_fifo();
+    void enable_data_ready_interrupt();
+    unsigned int fifo_count();
+    int read_fifo(mpu6000_sample *samples, int max_samples);
+    float sample_period();
 
     unsigned int set_gyro_scale(int scale);
     unsigned int set_acc_scale(int scale);
@@ -22,11 +58,16 @@ class mpu6000
 
     unsigned char write(unsigned char dataIn);
     unsigned char writeReg(unsigned char reg, unsigned char value);
+    unsigned char readReg(unsigned char reg);
 
     float acc_divider;
     float gyro_divider;
   private:
-   int channel;
+   spiTransport &spi_;
+   int sample_rate_div_ = 0;
+   int low_pass_filter_ = 0;
+
+   void decode_sample(const unsigned char *data, mpu6000_sample *sample);
 };
 
 #endif
@@ -59,6 +100,7 @@ class mpu6000
 #define MPUREG_CONFIG 0x1A
 #define MPUREG_GYRO_CONFIG 0x1B
 #define MPUREG_ACCEL_CONFIG 0x1C
+#define MPUREG_FIFO_EN 0x23
 #define MPUREG_INT_PIN_CFG 0x37
 #define MPUREG_INT_ENABLE 0x38
 #define MPUREG_ACCEL_XOUT_H 0x3B
@@ -116,5 +158,16 @@ class mpu6000
 #define BIT_INT_ANYRD_2CLEAR        0x10
 #define BIT_RAW_RDY_EN              0x01
 #define BIT_I2C_IF_DIS              0x10
+#define BIT_FIFO_EN                 0x40
+#define BIT_FIFO_RESET              0x04
+#define BIT_TEMP_FIFO_EN            0x80
+#define BIT_XG_FIFO_EN              0x40
+#define BIT_YG_FIFO_EN              0x20
+#define BIT_ZG_FIFO_EN              0x10
+#define BIT_ACCEL_FIFO_EN           0x08
+
+#define FIFO_SIZE                   1024
+// accel, temp and gyro words in register order, same layout as a read_all() burst
+#define FIFO_SAMPLE_SIZE            14
 
 #define READ_FLAG   0x80
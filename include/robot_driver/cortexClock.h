@@ -0,0 +1,54 @@
+#ifndef cortexClock_h
+#define cortexClock_h
+
+#include <boost/array.hpp>
+
+/**
+ * Estimates when the cortex measured each frame from host arrival times and the dt the cortex
+ * reports with every frame. Summing the dts gives the cortex's own clock; a line fitted over a
+ * sliding window maps it to host time, which takes out clock drift. Serial and scheduling
+ * delays only ever make frames late, so the line is moved down to the earliest arrival in the
+ * window instead of passing through the average one.
+ */
+class cortexClock
+{
+  public:
+    static const int windowSize = 128;
+
+    /**
+     * @param maxError A frame arriving this many seconds away from the estimate restarts the fit
+     */
+    explicit cortexClock(const double maxError = 0.25);
+
+    /**
+     * Adds a frame and estimates when it was measured
+     * @param  arrival Host time the frame arrived in seconds
+     * @param  dt      Cortex time since the previous frame in seconds
+     * @return         Host time the frame was measured in seconds
+     */
+    double update(const double arrival, const double dt);
+
+    /**
+     * Forgets every frame, for example after the cortex restarts
+     */
+    void reset();
+
+    /**
+     * Host seconds per cortex second over the current window
+     */
+    double skew() const { return skew_; }
+
+  private:
+    //Frames needed before the fit is trusted over the raw arrival time
+    static const int minFrames = 8;
+
+    const double maxError_;
+
+    //Ring of (cortex time, arrival) pairs
+    boost::array<double, windowSize> cortex_, host_;
+    int head_ = 0, count_ = 0;
+
+    double cortexTime_ = 0, lastArrival_ = 0, skew_ = 1;
+};
+
+#endif
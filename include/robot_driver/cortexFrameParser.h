@@ -0,0 +1,156 @@
+#ifndef cortexFrameParser_h
+#define cortexFrameParser_h
+
+#include <cstddef>
+#include <stdint.h>
+#include <boost/array.hpp>
+
+//Frame received from the cortex: start flag, type, count, then a payload whose length depends on the type
+struct cortexFrame
+{
+  static const int maxPayloadLength = 255;
+
+  uint8_t type;
+  uint8_t count;
+  uint8_t length;
+  boost::array<uint8_t, maxPayloadLength> payload;
+};
+
+//What the parser has seen of the link since it was constructed
+struct cortexLinkStatistics
+{
+  unsigned long frames = 0;       //frames handed out
+  unsigned long corrupt = 0;      //frames dropped for a wrong checksum
+  unsigned long unknownType = 0;  //start flags followed by a type without a payload length
+  unsigned long resyncs = 0;      //times bytes had to be skipped to find the next frame
+  unsigned long skippedBytes = 0; //bytes that were not part of any frame
+};
+
+/**
+ * CRC-16/CCITT-FALSE (polynomial 0x1021, no reflection) of some bytes
+ * @param  data   Bytes
+ * @param  length Number of bytes
+ * @param  crc    CRC of the bytes before, to continue it
+ * @return        CRC
+ */
+uint16_t cortexCrc16(const uint8_t *data, const size_t length, const uint16_t crc = 0xFFFF);
+
+/**
+ * Builds a whole frame: start flag, type, count, payload and, from protocol version 2 on, its
+ * checksum. Sending it is a single write.
+ * @param  type    Message type
+ * @param  count   Message count
+ * @param  payload Payload bytes
+ * @param  length  Number of payload bytes, at most cortexFrame::maxPayloadLength
+ * @param  version Protocol version, see cortexFrameParser
+ * @param  out     Filled with the frame, room for cortexFrameParser::maxFrameLength bytes
+ * @return         Frame length
+ */
+size_t buildCortexFrame(const uint8_t type, const uint8_t count, const uint8_t *payload, const size_t length,
+                        const int version, uint8_t *out);
+
+/**
+ * Incremental parser for the cortex UART framing. Bytes can be fed in chunks of any size;
+ * a chunk may end in the middle of a frame or hold several frames.
+ *
+ * Protocol version 1 is the original framing. Version 2 follows the payload with the
+ * cortexCrc16 of type, count and payload, little endian. A frame with a wrong checksum or an
+ * unknown type means the start flag was really a data byte: the parser then looks for the next
+ * start flag among the bytes it had taken for that frame, so no frame behind it is lost.
+ */
+class cortexFrameParser
+{
+  public:
+    static const uint8_t startFlag = 0xFA;
+    static const int headerLength = 3; //start flag, type, count
+    static const int crcLength = 2;
+    static const int maxFrameLength = headerLength + cortexFrame::maxPayloadLength + crcLength;
+
+    cortexFrameParser();
+
+    /**
+     * Sets the payload length for a message type. Types without a length are not accepted.
+     * @param type   Message type
+     * @param length Payload length
+     */
+    void setPayloadLength(const uint8_t type, const uint8_t length);
+
+    /**
+     * Makes a message type's payload start with the number of payload bytes after that first
+     * byte, so each frame of the type can have another length
+     * @param type Message type
+     */
+    void setLengthPrefixed(const uint8_t type);
+
+    /**
+     * Sets the framing of the frames from the next start flag on
+     * @param version 1 for no checksum, 2 for a CRC-16 after the payload
+     */
+    void setVersion(const int version) { version_ = version; }
+
+    int getVersion() const { return version_; }
+
+    /**
+     * Parses bytes until a frame is complete or the bytes run out
+     * @param  data   Received bytes
+     * @param  length Number of received bytes
+     * @param  frame  Set to the completed frame, or nullptr if more bytes are needed. The frame
+     *                stays valid until the next call.
+     * @return        Number of bytes consumed, possibly none when a frame came out of bytes
+     *                kept from an earlier call
+     */
+    size_t parse(const uint8_t *data, const size_t length, const cortexFrame **frame);
+
+    /**
+     * Drops any partially received frame and waits for the next start flag
+     */
+    void reset();
+
+    /**
+     * Whether the parser is between frames, waiting for a start flag
+     */
+    bool idle() const { return state_ == waitStart; }
+
+    const cortexLinkStatistics &getStatistics() const { return statistics_; }
+
+  private:
+    enum parserState { waitStart, readType, readCount, readLength, readPayload, readCrc };
+
+    parserState state_ = waitStart;
+    int version_ = 1;
+    size_t received_ = 0;
+    cortexFrame frame_;
+    boost::array<uint8_t, crcLength> crc_;
+    boost::array<uint8_t, 256> payloadLengths_;
+    boost::array<bool, 256> known_, prefixed_;
+
+    //Bytes of a rejected frame that are parsed again before any new ones
+    boost::array<uint8_t, maxFrameLength> backlog_;
+    size_t backlogOffset_ = 0, backlogLength_ = 0;
+
+    bool rejected_ = false, skipping_ = false;
+    cortexLinkStatistics statistics_;
+
+    /**
+     * Runs the state machine over bytes until a frame is complete, one is rejected, or the bytes run out
+     * @return Number of bytes consumed
+     */
+    size_t scan(const uint8_t *data, const size_t length, const cortexFrame **frame);
+
+    /**
+     * Hands out the current frame if its checksum is right, rejects it otherwise
+     */
+    void finish(const cortexFrame **frame);
+
+    /**
+     * Queues the bytes of the rejected frame after its start flag to be parsed again
+     */
+    void resync();
+
+    /**
+     * Counts bytes skipped while looking for a start flag
+     */
+    void skip(const size_t count);
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef cortexReceiver_h
+#define cortexReceiver_h
+
+#include <atomic>
+#include <stdint.h>
+#include <boost/array.hpp>
+
+#include "robot_driver/cortexClock.h"
+#include "robot_driver/cortexFrameParser.h"
+#include "robot_driver/diffDriveOdometry.h"
+#include "robot_driver/imuFeed.h"
+#include "robot_driver/imuPreintegration.h"
+#include "robot_driver/latencyMonitor.h"
+#include "robot_driver/seqlock.h"
+
+//What a std frame held, after it was integrated
+struct cortexStdFrame
+{
+  int32_t leftQuad, rightQuad;
+  uint8_t dt;    //ms, 15 when the cortex sent 0
+  double stamp;  //seconds, when the cortex measured it
+  bool tipped;   //the odometry held still because the robot tipped backwards
+};
+
+/**
+ * Everything robotPOS does with the bytes it reads from the cortex that doesn't need ROS: parsing
+ * them into frames, counting the frames lost on the way, stamping std frames with when the cortex
+ * measured them and integrating them with the IMU fused in. frame_alloc_check runs the same code.
+ * Only call from the RX thread, except where noted.
+ */
+class cortexReceiver
+{
+  public:
+    /**
+     * @param geometry Wheel geometry and noise for the dead reckoning
+     * @param imu      IMU samples to fuse, filled by the sampling thread
+     * @param latency  Monitor to mark each frame's stages in
+     */
+    cortexReceiver(const diffDriveGeometry &geometry, imuFeed &imu, latencyMonitor &latency);
+
+    /**
+     * Sets the payload length for a type of frame, see cortexFrameParser
+     */
+    void setPayloadLength(const uint8_t type, const uint8_t length) { parser_.setPayloadLength(type, length); }
+
+    /**
+     * Switches to the framing and sequence counting of a protocol version, for the frames after
+     * the current one
+     * @param version Protocol version agreed with the cortex
+     */
+    void setVersion(const int version) { parser_.setVersion(version); }
+
+    /**
+     * Sets whether the yaw the gyro integrated over each frame is fused into the odometry
+     */
+    void setFuseYaw(const bool fuseYaw) { fuseYaw_ = fuseYaw; }
+
+    /**
+     * Parses received bytes up to the end of the next frame. Marks the latency of a frame that
+     * starts or completes in them and counts the frames lost before it.
+     * @param  data    Received bytes
+     * @param  length  Number of bytes
+     * @param  arrival When the bytes arrived, on the monotonic clock
+     * @param  frame   Set to the completed frame, valid until the next call, or nullptr
+     * @return         Number of bytes consumed
+     */
+    size_t parse(const uint8_t *data, const size_t length, const monotonicClock::time_point arrival,
+                 const cortexFrame **frame);
+
+    /**
+     * Stamps a std frame and integrates it into the odometry, with what the IMU measured since
+     * the last one
+     * @param frame   Std frame from parse
+     * @param arrival When its bytes arrived on the host clock in seconds
+     * @param values  Filled with what the frame held
+     */
+    void handleStd(const cortexFrame &frame, const double arrival, cortexStdFrame *values);
+
+    /**
+     * Dead reckoning up to the last std frame
+     */
+    const diffDriveOdometry &odometry() const { return odometry_; }
+
+    /**
+     * Takes what the IMU measured over the last std frame
+     * @param  window Filled with the samples since the frame before
+     * @return        False if no sample arrived during the frame, or it was already taken
+     */
+    bool takeFrameImu(imuPreintegration *window);
+
+    /**
+     * Returns the parser's counters. Safe from any thread.
+     */
+    cortexLinkStatistics getStatistics() const { return linkStatistics_.load(); }
+
+    /**
+     * Number of frames lost on the way, from gaps in their counts. Safe from any thread.
+     */
+    unsigned long getMissedFrames() const { return missedFrames_.load(std::memory_order_relaxed); }
+
+  private:
+    cortexFrameParser parser_;
+    seqlock<cortexLinkStatistics> linkStatistics_; //parser_'s, for diagnostics on another thread
+
+    //Last count received per type, to count the frames lost on the way
+    boost::array<uint8_t, 256> counts_;
+    boost::array<bool, 256> countValid_;
+    std::atomic<unsigned long> missedFrames_{0};
+
+    //Maps cortex dts to host time to stamp frames with when they were measured
+    cortexClock clock_;
+
+    //Dead reckoning from the cortex's quad counts, with the gyro's yaw fused in when fuseYaw_
+    diffDriveOdometry odometry_;
+    bool fuseYaw_ = true;
+
+    imuFeed &imu_;
+    imuPreintegration frameImu_; //what the IMU measured over the last std frame
+    bool frameImuValid_ = false;
+
+    latencyMonitor &latency_;
+
+    /**
+     * Counts the frames of a type lost since the last one received
+     * @param  type  Message type
+     * @param  count Message count
+     * @return       Number of frames missing before this one
+     */
+    int sequenceGap(const uint8_t type, const uint8_t count);
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef diffDriveOdometry_h
+#define diffDriveOdometry_h
+
+#include <stdint.h>
+#include <boost/array.hpp>
+
+//How quad counts turn into motion, and how much to trust them
+struct diffDriveGeometry
+{
+  double straightConversion = 0.716457354; //mm travelled per count of the average of both wheels
+  double thetaConversion = 0.00270938;     //radians turned per count of half the difference of the wheels
+
+  //Variance of a wheel's count, per count it moved, plus the quantization variance of a count
+  double countVariancePerCount = 0.05;
+  double countQuantizationVariance = 1.0 / 12;
+
+  /**
+   * Distance between the wheels these conversions imply in meters
+   */
+  double trackWidth() const { return 2 * straightConversion / 1000 / thetaConversion; }
+};
+
+/**
+ * Dead reckoning for a differential drive from cumulative quad counts. Integrates each step
+ * along the exact circular arc the wheels drove, in double precision, and propagates the pose
+ * covariance. Every update takes the same time and never allocates.
+ */
+class diffDriveOdometry
+{
+  public:
+    //3x3 covariance of x, y and heading, row major
+    typedef boost::array<double, 9> poseCovariance;
+
+    //2x2 covariance of linear and angular velocity, row major
+    typedef boost::array<double, 4> twistCovariance;
+
+    explicit diffDriveOdometry(const diffDriveGeometry &geometry = diffDriveGeometry());
+
+    /**
+     * Sets the pose and forgets its uncertainty. The next counts only set the starting point.
+     * @param x     X position in meters
+     * @param y     Y position in meters
+     * @param theta Heading in radians
+     */
+    void reset(const double x = 0, const double y = 0, const double theta = 0);
+
+    /**
+     * Moves by the counts since the last update
+     * @param  leftCount  Cumulative left quad count
+     * @param  rightCount Cumulative right quad count
+     * @param  dt         Time since the last update in seconds
+     * @return            False for the first counts after a reset, which only set the starting point
+     */
+    bool update(const int32_t leftCount, const int32_t rightCount, const double dt);
+
+    /**
+     * Moves by the counts since the last update, with the heading change fused with what a gyro
+     * measured over the same step. The gyro also corrects the distance when the wheel counts
+     * made distance and heading change correlated.
+     * @param  leftCount    Cumulative left quad count
+     * @param  rightCount   Cumulative right quad count
+     * @param  dt           Time since the last update in seconds
+     * @param  gyroDtheta   Heading change the gyro integrated over dt in radians
+     * @param  gyroVariance Variance of gyroDtheta
+     * @return              False for the first counts after a reset, which only set the starting point
+     */
+    bool update(const int32_t leftCount, const int32_t rightCount, const double dt,
+                const double gyroDtheta, const double gyroVariance);
+
+    /**
+     * Takes new counts without moving, for when the wheels turned but the robot didn't
+     * @param leftCount  Cumulative left quad count
+     * @param rightCount Cumulative right quad count
+     */
+    void hold(const int32_t leftCount, const int32_t rightCount);
+
+    double x() const { return x_; }
+    double y() const { return y_; }
+    double theta() const { return theta_; }
+
+    double linearVelocity() const { return v_; }
+    double angularVelocity() const { return omega_; }
+
+    const poseCovariance& getPoseCovariance() const { return poseCov_; }
+    const twistCovariance& getTwistCovariance() const { return twistCov_; }
+
+    int32_t leftDelta() const { return leftDelta_; }
+    int32_t rightDelta() const { return rightDelta_; }
+
+    /**
+     * Gyro heading change minus the wheels' over the last fused update, large when a wheel slipped
+     */
+    double gyroInnovation() const { return gyroInnovation_; }
+
+    const diffDriveGeometry& getGeometry() const { return geometry_; }
+
+  private:
+    const diffDriveGeometry geometry_;
+
+    bool primed_ = false;
+    int32_t lastLeft_ = 0, lastRight_ = 0;
+    int32_t leftDelta_ = 0, rightDelta_ = 0;
+
+    double x_ = 0, y_ = 0, theta_ = 0;
+    double v_ = 0, omega_ = 0;
+    double gyroInnovation_ = 0;
+
+    poseCovariance poseCov_;
+    twistCovariance twistCov_;
+
+    /**
+     * Moves by the counts since the last update, fusing the gyro when there is one
+     */
+    bool integrate(const int32_t leftCount, const int32_t rightCount, const double dt,
+                   const bool fuseGyro, const double gyroDtheta, const double gyroVariance);
+};
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef flightRecord_h
+#define flightRecord_h
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "robot_driver/MPU6000.h"
+#include "robot_driver/imuCalibration.h"
+
+/*
+ * Flight record file layout. A fixed size file: one page of flightFileHeader, then a ring of
+ * records. Every record starts with a flightRecordHeader on an 8 byte boundary and never wraps
+ * around the end of the ring; the writer fills the end with a padding record instead, or skips
+ * it when not even a header fits. Positions count bytes written since the file was created and
+ * only grow, a position's place in the ring is position % capacity. Records between tail and
+ * head are complete. Records past head with the right position and CRC were written after the
+ * header was last updated and are complete as well.
+ */
+
+enum flightRecordType : uint8_t
+{
+  flightPadding = 0,      //fills the end of the ring, no data
+  flightSessionStart = 1, //the recorder was opened, no data
+  flightSerial = 2,       //bytes read from the cortex UART, in order
+  flightImu = 3,          //one MPU6000 burst, see encodeImuRecord
+  flightImuBias = 4       //the IMU bias model the following bursts start from, see encodeImuBiasRecord
+};
+
+//flightSerial flag: the next record holds more bytes of the same read
+static const uint8_t flightSerialContinued = 1;
+
+struct flightFileHeader
+{
+  char magic[8];     //flightFileMagic
+  uint32_t version;  //flightFileVersion
+  uint32_t dataOffset; //where the ring starts in the file
+  uint64_t capacity; //ring size in bytes, a multiple of 8
+  uint64_t tail;     //position of the oldest record
+  uint64_t head;     //position the next record goes to
+};
+
+struct flightRecordHeader
+{
+  uint32_t crc;        //CRC-32 of the rest of the header and the data, see flightRecordCrc
+  uint8_t type;        //flightRecordType
+  uint8_t flags;
+  uint16_t length;     //bytes of data after the header
+  uint64_t position;   //where the record was written
+  int64_t monotonicNs; //steady clock, comparable within a session
+  int64_t rosNs;       //ROS time
+};
+
+static const char flightFileMagic[8] = {'R', 'D', 'F', 'L', 'I', 'G', 'H', 'T'};
+static const uint32_t flightFileVersion = 1;
+static const uint32_t flightDataOffset = 4096;
+static const size_t flightRecordAlignment = 8;
+static const size_t flightImuRecordLength = 7 * 2 + 7 * 4;
+static const size_t flightImuBiasRecordLength = 15 * 8 + 1;
+
+//A record as stored, pointing into the file
+struct flightRecordView
+{
+  flightRecordType type;
+  uint8_t flags;
+  uint16_t length;
+  uint64_t position;
+  int64_t monotonicNs, rosNs;
+  const uint8_t *data;
+};
+
+/**
+ * Bytes a record with some data takes in the ring
+ */
+inline size_t flightRecordSize(const size_t length)
+{
+  return (sizeof(flightRecordHeader) + length + flightRecordAlignment - 1) & ~(flightRecordAlignment - 1);
+}
+
+/**
+ * CRC-32 (IEEE) of some bytes
+ * @param  data   Bytes
+ * @param  length Number of bytes
+ * @param  crc    CRC of the bytes before, to continue it
+ * @return        CRC
+ */
+uint32_t crc32(const uint8_t *data, const size_t length, const uint32_t crc = 0);
+
+/**
+ * Computes a record's CRC from its header fields and data. Padding only covers its header.
+ */
+uint32_t flightRecordCrc(const flightRecordHeader &header, const uint8_t *data);
+
+/**
+ * Finds where the complete records starting at a position end
+ * @param  ring     Start of the ring
+ * @param  capacity Ring size in bytes
+ * @param  from     Position of the first record
+ * @return          Position after the last complete record, from if there is none
+ */
+uint64_t scanFlightRecords(const uint8_t *ring, const uint64_t capacity, const uint64_t from);
+
+/**
+ * Packs an IMU burst into a flightImu record's data: the raw accel, temperature and gyro words
+ * then the scaled accel, temperature and gyro, little endian
+ * @param sample IMU sample
+ * @param data   Filled with flightImuRecordLength bytes
+ */
+void encodeImuRecord(const mpu6000_sample &sample, uint8_t *data);
+
+/**
+ * Unpacks a flightImu record
+ * @param  record Record
+ * @param  sample Filled with the IMU sample
+ * @return        False if the record isn't an IMU sample
+ */
+bool decodeImuRecord(const flightRecordView &record, mpu6000_sample *sample);
+
+/**
+ * Packs an IMU bias model into a flightImuBias record's data: the offsets, slopes, reference,
+ * min and max temperatures as doubles then whether the temperatures are known, little endian
+ * @param model Bias model
+ * @param data  Filled with flightImuBiasRecordLength bytes
+ */
+void encodeImuBiasRecord(const imuBiasModel &model, uint8_t *data);
+
+/**
+ * Unpacks a flightImuBias record
+ * @param  record Record
+ * @param  model  Filled with the bias model
+ * @return        False if the record isn't a bias model
+ */
+bool decodeImuBiasRecord(const flightRecordView &record, imuBiasModel *model);
+
+/**
+ * Reads the records of a flight record file from oldest to newest. Works on a file that is
+ * still being recorded: it sees the records complete when it was opened, and stops early if
+ * the writer overwrites the ones it hasn't reached.
+ */
+class flightRecordReader
+{
+  public:
+    flightRecordReader() {}
+    ~flightRecordReader() { close(); }
+
+    flightRecordReader(const flightRecordReader&) = delete;
+    flightRecordReader& operator=(const flightRecordReader&) = delete;
+
+    /**
+     * Maps a file and finds its records
+     * @param  path File to read
+     * @return      False if the file can't be read or isn't a flight record
+     */
+    bool open(const std::string &path);
+
+    void close();
+
+    /**
+     * Returns the next record, skipping padding. Its data stays valid until the reader is closed.
+     * @param  record Filled with the record
+     * @return        False after the newest record
+     */
+    bool next(flightRecordView *record);
+
+    /**
+     * Goes back to the oldest record, and to reading every session
+     */
+    void rewind() { cursor_ = tail_; stop_ = end_; }
+
+    /**
+     * Limits the reader to one session: from its flightSessionStart record up to the next one
+     * @param  index Session counted from the oldest one whose start is still in the file, or
+     *               from the newest when negative, -1 being the newest
+     * @return       False if there is no such session, the reader then reads every session
+     */
+    bool selectSession(const int index);
+
+    uint64_t getCapacity() const { return capacity_; }
+
+    /**
+     * Bytes of complete records in the file
+     */
+    uint64_t getRecordedBytes() const { return end_ - tail_; }
+
+  private:
+    int fd_ = -1;
+    const uint8_t *map_ = nullptr;
+    size_t mapSize_ = 0;
+
+    const uint8_t *ring_ = nullptr;
+    uint64_t capacity_ = 0, tail_ = 0, end_ = 0, cursor_ = 0;
+    uint64_t stop_ = 0; //where next stops, end_ unless a session is selected
+};
+
+#endif
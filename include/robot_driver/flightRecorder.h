@@ -0,0 +1,156 @@
+#ifndef flightRecorder_h
+#define flightRecorder_h
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "robot_driver/flightRecord.h"
+#include "robot_driver/spscRing.h"
+
+/**
+ * Steady clock time in nanoseconds, the recorder's monotonic timestamps
+ */
+inline int64_t steadyNs(const std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now())
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/**
+ * Always-on recorder of the driver's raw inputs: bytes from the cortex UART and IMU bursts, each
+ * with monotonic and ROS timestamps. Recording only copies into a lock-free queue; a background
+ * thread appends the records to a preallocated, memory mapped ring file (see flightRecord.h).
+ * Mapped pages belong to the kernel, so a crash of the driver loses nothing the thread had
+ * written, and the CRCs catch records a power cut tore. A new session keeps
+ * appending to a file left by the last one. Read it back with flightRecordReader.
+ */
+class flightRecorder
+{
+  public:
+    //Bytes of UART data per record, longer reads are split over several
+    static const size_t maxSerialChunk = 64;
+
+    //Bytes of data the largest record holds
+    static const size_t maxRecordLength = 128;
+
+    flightRecorder() {}
+    ~flightRecorder() { close(); }
+
+    flightRecorder(const flightRecorder&) = delete;
+    flightRecorder& operator=(const flightRecorder&) = delete;
+
+    /**
+     * Creates or reopens the ring file and starts the writing thread
+     * @param  path File to record to
+     * @param  size File size in bytes. A file of another size is started over.
+     * @return      False if the file can't be created or mapped
+     */
+    bool open(const std::string &path, const size_t size);
+
+    /**
+     * Writes what is queued, stops the writing thread and syncs the file
+     */
+    void close();
+
+    bool isOpen() const { return thread_.joinable(); }
+
+    /**
+     * Queues bytes read from the cortex. Only call from one thread, and never at the same time
+     * as open or close.
+     * @param data        Bytes read
+     * @param length      Number of bytes
+     * @param monotonicNs Arrival time on the steady clock in nanoseconds
+     * @param rosNs       Arrival time in ROS time in nanoseconds
+     */
+    void recordSerial(const uint8_t *data, const size_t length, const int64_t monotonicNs, const int64_t rosNs);
+
+    /**
+     * Queues an IMU burst. Only call from one thread, and never at the same time as open or close.
+     * @param sample      IMU sample
+     * @param monotonicNs Measurement time on the steady clock in nanoseconds
+     * @param rosNs       Measurement time in ROS time in nanoseconds
+     */
+    void recordImu(const mpu6000_sample &sample, const int64_t monotonicNs, const int64_t rosNs);
+
+    /**
+     * Queues the IMU bias model the next bursts start from, so a replay can remove the same bias.
+     * Call from the same thread as recordImu.
+     * @param model       Bias model
+     * @param monotonicNs Time on the steady clock in nanoseconds
+     * @param rosNs       Time in ROS time in nanoseconds
+     */
+    void recordImuBias(const imuBiasModel &model, const int64_t monotonicNs, const int64_t rosNs);
+
+    /**
+     * Number of records dropped because the writing thread fell behind
+     */
+    unsigned long getDropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /**
+     * Number of records written this session
+     */
+    unsigned long getWritten() const { return written_.load(std::memory_order_relaxed); }
+
+  private:
+    //A record waiting to be written
+    struct entry
+    {
+      uint8_t type, flags;
+      uint16_t length;
+      int64_t monotonicNs, rosNs;
+      uint8_t data[maxRecordLength];
+    };
+
+    static_assert(maxSerialChunk <= maxRecordLength && flightImuRecordLength <= maxRecordLength &&
+                  flightImuBiasRecordLength <= maxRecordLength, "flightRecorder entries must fit every record");
+
+    //A couple of seconds of the busiest input between writer wakeups
+    static const size_t queueCapacity = 1024;
+    typedef spscRing<entry, queueCapacity> entryQueue;
+
+    static constexpr double writePeriod = 0.01, syncPeriod = 1.0; //seconds
+
+    entryQueue serialQueue_, imuQueue_;
+    std::atomic<unsigned long> dropped_{0}, written_{0};
+
+    int fd_ = -1;
+    uint8_t *map_ = nullptr;
+    size_t mapSize_ = 0;
+    flightFileHeader *header_ = nullptr;
+    uint8_t *ring_ = nullptr;
+    uint64_t capacity_ = 0, tail_ = 0, head_ = 0;
+
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    /**
+     * Queues an entry, counting it as dropped if the queue is full
+     */
+    void enqueue(entryQueue *queue, const entry &item);
+
+    /**
+     * Writing thread main loop
+     */
+    void run();
+
+    /**
+     * Writes every queued entry, oldest first
+     */
+    void drain();
+
+    /**
+     * Appends one record to the ring, overwriting the oldest ones to make room
+     */
+    void append(const uint8_t type, const uint8_t flags, const uint8_t *data, const uint16_t length,
+                const int64_t monotonicNs, const int64_t rosNs);
+
+    /**
+     * Moves tail past every record that overlaps the bytes up to a position
+     */
+    void release(const uint64_t end);
+
+    void storeHeader();
+};
+
+#endif
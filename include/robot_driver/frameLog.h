@@ -0,0 +1,26 @@
+#ifndef frameLog_h
+#define frameLog_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//Std frames robot_driver logged when ~clock_log is set, as columns
+struct frameLog
+{
+  std::vector<double> arrival; //host time the frame arrived in seconds
+  std::vector<double> dt;      //cortex's time since its previous frame in seconds
+  std::vector<int32_t> left, right; //cumulative quad counts
+
+  size_t size() const { return dt.size(); }
+};
+
+/**
+ * Reads a log of "arrival_sec,dt_ms,left,right" lines
+ * @param  path File to read
+ * @param  log  Filled with the frames
+ * @return      False if the file couldn't be opened
+ */
+bool readFrameLog(const std::string &path, frameLog *log);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef gpioEventSource_h
+#define gpioEventSource_h
+
+#include <memory>
+#include <string>
+
+/**
+ * Rising edges on the line the MPU6000's INT pin drives. Backends throw
+ * boost::system::system_error when the line can't be watched.
+ */
+class gpioEventSource
+{
+  public:
+    virtual ~gpioEventSource() {}
+
+    /**
+     * Blocks until the line has risen or the timeout passed
+     * @param  timeoutMs Longest wait in milliseconds
+     * @return           Edges since the last call, 0 on timeout
+     */
+    virtual int wait(const int timeoutMs) = 0;
+};
+
+/**
+ * Rising edges from the Linux GPIO character device, waited for with poll() on a line event fd
+ */
+class gpioChardevEvents : public gpioEventSource
+{
+  public:
+    /**
+     * Requests rising edge events on a line
+     * @param chip GPIO chip device, e.g. /dev/gpiochip0
+     * @param line Line offset on the chip
+     */
+    gpioChardevEvents(const std::string &chip, const int line);
+    ~gpioChardevEvents();
+
+    int wait(const int timeoutMs) override;
+
+  private:
+    int fd_;
+};
+
+/**
+ * Simulated edges at a fixed period from a timerfd, for running without the chip. Edges the
+ * reader was too late for are counted like a line event fd queues them.
+ */
+class gpioSimEvents : public gpioEventSource
+{
+  public:
+    /**
+     * @param period Seconds between edges, the simulated chip's sample period
+     */
+    explicit gpioSimEvents(const double period);
+    ~gpioSimEvents();
+
+    int wait(const int timeoutMs) override;
+
+  private:
+    int fd_;
+};
+
+/**
+ * Creates a data ready event source
+ * @param  chip   GPIO chip device, or "sim" for edges at the sample period
+ * @param  line   Line offset on the chip
+ * @param  period Sample period in seconds, for "sim"
+ * @return        The event source
+ */
+std::unique_ptr<gpioEventSource> createGpioEventSource(const std::string &chip, const int line, const double period);
+
+#endif
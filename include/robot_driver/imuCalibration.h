@@ -0,0 +1,180 @@
+#ifndef imuCalibration_h
+#define imuCalibration_h
+
+#include <string>
+
+#include "robot_driver/MPU6000.h"
+
+//IMU constant offsets, accel in Gs and gyro in Degrees per second
+struct imuBias
+{
+  double acc[3] = {0, 0, 0};
+  double rot[3] = {0, 0, 0};
+};
+
+//IMU bias as a straight line in die temperature around a reference temperature
+struct imuBiasModel
+{
+  imuBias offset; //bias at referenceTemperature
+  imuBias slope;  //change in bias per °C
+
+  //Whether the temperatures are known, a model without them holds the same bias at any temperature
+  bool hasTemperature = false;
+  double referenceTemperature = 0; //°C
+  double minTemperature = 0, maxTemperature = 0; //range of temperatures the model has seen, °C
+
+  /**
+   * Returns the bias at a die temperature
+   * @param  temperature Die temperature in °C, from the same burst as the sample
+   * @return             Bias
+   */
+  imuBias at(const double temperature) const;
+
+  /**
+   * Whether the model can be trusted at a die temperature
+   * @param  temperature Die temperature in °C
+   * @param  margin      How far outside the seen temperatures to trust the model in °C
+   * @return             True if close enough to the temperatures the model has seen
+   */
+  bool covers(const double temperature, const double margin) const;
+};
+
+//Everything worth keeping about an IMU between runs
+struct imuCalibration
+{
+  imuBiasModel bias;
+
+  //The chip and how it was set up when the bias was measured, lets a restart skip initialization
+  bool hasChipState = false;
+  unsigned int whoami = 0;
+  mpu6000_config registers = {0, 0, 0, 0, 0};
+  float accDivider = 0, gyroDivider = 0;
+};
+
+/**
+ * Reads a calibration saved by saveImuCalibration
+ * @param  path        Calibration file
+ * @param  calibration Filled with the calibration
+ * @return             False if the file is missing or has no bias. Temperatures, slopes and chip
+ *                     state are optional.
+ */
+bool loadImuCalibration(const std::string &path, imuCalibration *calibration);
+
+/**
+ * Writes a calibration, replacing the file in one step so a crash never leaves half of it
+ * @param  path        Calibration file
+ * @param  calibration Calibration to save
+ * @return             False if the file couldn't be written
+ */
+bool saveImuCalibration(const std::string &path, const imuCalibration &calibration);
+
+/**
+ * Running mean and variance of all six IMU axes and the die temperature at once (Welford's algorithm)
+ */
+class imuStatistics
+{
+  public:
+    /**
+     * Adds a sample to every axis
+     * @param sample IMU sample
+     */
+    void add(const mpu6000_sample &sample);
+
+    /**
+     * Forgets every sample
+     */
+    void reset();
+
+    int count() const { return count_; }
+
+    /**
+     * Means of every axis, accel in Gs and gyro in Degrees per second
+     */
+    imuBias mean() const;
+
+    /**
+     * Mean die temperature in °C
+     */
+    double meanTemperature() const { return mean_[6]; }
+
+    /**
+     * Largest standard deviation over the accel axes in Gs
+     */
+    double maxAccStdDev() const;
+
+    /**
+     * Largest standard deviation over the gyro axes in Degrees per second
+     */
+    double maxRotStdDev() const;
+
+  private:
+    int count_ = 0;
+    double mean_[7] = {0, 0, 0, 0, 0, 0, 0};
+    double m2_[7] = {0, 0, 0, 0, 0, 0, 0};
+};
+
+/**
+ * Keeps refining the bias model while the robot stands still. Samples are grouped into short
+ * windows; a window quiet enough on every axis, and whose mean is close to what the model
+ * predicts, counts as stationary. The offset follows stationary windows with an exponential
+ * weight. The slope is a least squares fit over a much longer, exponentially forgotten history
+ * of stationary windows, refitted once that history spans enough temperature. Only call from
+ * one thread.
+ */
+class imuBiasTracker
+{
+  public:
+    /**
+     * @param windowLength Samples per window
+     * @param weight       Weight of a stationary window in the new offset
+     * @param forgetting   Weight left on the slope history after each stationary window
+     */
+    explicit imuBiasTracker(const int windowLength = 250, const double weight = 0.05, const double forgetting = 0.999);
+
+    /**
+     * Adds a sample
+     * @param  sample IMU sample
+     * @param  model  Bias model to refine
+     * @return        True if model changed
+     */
+    bool add(const mpu6000_sample &sample, imuBiasModel *model);
+
+    /**
+     * Forgets every sample and window, as if just constructed
+     */
+    void reset();
+
+    /**
+     * Whether a window is quiet enough to be taken as the robot standing still
+     * @param  statistics Statistics of the window
+     * @return            True if stationary
+     */
+    static bool isStationary(const imuStatistics &statistics);
+
+    /**
+     * Number of windows used to refine the model so far
+     */
+    unsigned long getUpdates() const { return updates_; }
+
+  private:
+    //Noise limits for a stationary window, a few times the MPU6000's noise with the 20Hz filter
+    static constexpr double stillAccStdDevG = 0.01, stillRotStdDevDps = 0.3;
+
+    //A steady turn is quiet too, so the window's mean must also be near the predicted bias
+    static constexpr double maxAccChangeG = 0.05, maxRotChangeDps = 1.0;
+
+    //Temperature standard deviation the slope history needs before the slope is refitted, °C
+    static constexpr double minSlopeSpread = 1.0;
+
+    const int windowLength_;
+    const double weight_, forgetting_;
+    imuStatistics window_;
+    unsigned long updates_ = 0;
+
+    //Exponentially forgotten sums over stationary windows: weight, t, t^2, bias and t * bias per
+    //axis, with t the temperature relative to the model's reference
+    double sumWeight_ = 0, sumT_ = 0, sumTT_ = 0;
+    double sumBias_[6] = {0, 0, 0, 0, 0, 0}, sumTBias_[6] = {0, 0, 0, 0, 0, 0};
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef imuFeed_h
+#define imuFeed_h
+
+#include "robot_driver/MPU6000.h"
+#include "robot_driver/imuCalibration.h"
+#include "robot_driver/imuPreintegration.h"
+#include "robot_driver/seqlock.h"
+
+constexpr float gravity = 9.80665;
+
+/**
+ * What the IMU sampling thread hands the odometry: the newest sample, the bias model and every
+ * sample pre-integrated since the last frame. One thread adds samples while another reads, and
+ * neither ever waits for the other.
+ */
+class imuFeed
+{
+  public:
+    explicit imuFeed(const imuNoise &noise = imuNoise()): preintegrator_(noise) {}
+
+    /**
+     * Publishes a new bias model. Only call from the producer thread.
+     * @param model Bias model
+     */
+    void setBias(const imuBiasModel &model) { bias_.store(model); }
+
+    /**
+     * Makes a sample the latest without integrating it, so there is one before sampling starts.
+     * Only call from the producer thread.
+     * @param data Raw sample
+     */
+    void setLatest(const mpu6000_sample &data) { latest_.store(data); }
+
+    /**
+     * Makes a sample the latest and integrates it. Only call from the producer thread.
+     * @param stamp When it was measured in seconds
+     * @param data  Raw sample
+     * @param bias  Bias to remove before integrating it
+     */
+    void add(const double stamp, const mpu6000_sample &data, const imuBias &bias);
+
+    /**
+     * Returns the newest raw sample. Safe from any thread.
+     */
+    mpu6000_sample latest() const { return latest_.load(); }
+
+    /**
+     * Returns the current bias model. Safe from any thread.
+     */
+    imuBiasModel getBiasModel() const { return bias_.load(); }
+
+    /**
+     * Returns the current bias. Safe from any thread.
+     * @param  temperature Die temperature in °C, from the sample the bias is for
+     * @return             Bias at that temperature
+     */
+    imuBias getBias(const float temperature) const { return bias_.load().at(temperature); }
+
+    /**
+     * Takes what the IMU measured since the last call. Only call from one consumer thread, the
+     * odometry's.
+     * @param  window Filled with the yaw integrated, the mean acceleration and their variances
+     * @return        False if no sample arrived since the last call
+     */
+    bool takePreintegration(imuPreintegration *window) { return preintegrator_.take(window); }
+
+    /**
+     * Removes the bias from a sample and rotates it into base_link
+     * @param data    Raw sample
+     * @param bias    Bias to remove
+     * @param yawRate Filled with the yaw rate in rad/s
+     * @param acc     Filled with the acceleration in m/s^2
+     */
+    static void toBaseLink(const mpu6000_sample &data, const imuBias &bias, double *yawRate, double acc[3]);
+
+  private:
+    seqlock<imuBiasModel> bias_;
+    seqlock<mpu6000_sample> latest_;
+    imuPreintegrator preintegrator_;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef imuPreintegration_h
+#define imuPreintegration_h
+
+#include <stdint.h>
+#include <boost/array.hpp>
+
+#include "robot_driver/seqlock.h"
+
+//How much to trust bias corrected IMU samples
+struct imuNoise
+{
+  double yawRateDensity = 7.6e-9; //(rad/s)^2 per Hz of gyro white noise, 0.005 dps/sqrt(Hz) on the MPU6000
+  double yawBiasVariance = 3e-8;  //(rad/s)^2 left in the bias estimate, 0.01 dps; it doesn't average out
+  double accVariance = 1e-3;      //(m/s^2)^2 of one accel sample, used until a window has the samples to measure it
+};
+
+//Running sums over every sample since the start, in base_link. Windows are differences of two of these.
+struct imuIntegral
+{
+  double stamp = 0;  //seconds, of the newest sample
+  uint64_t samples = 0;
+  double yaw = 0;    //integrated yaw rate, radians
+  double acc[3] = {0, 0, 0};                //sums of accelerations, m/s^2
+  double accProducts[6] = {0, 0, 0, 0, 0, 0}; //sums of xx, xy, xz, yy, yz, zz
+};
+
+//What the IMU measured between two odometry frames
+struct imuPreintegration
+{
+  int samples = 0;
+  double span = 0;            //seconds the samples cover
+  double deltaYaw = 0;        //integrated yaw rate, radians
+  double yawRate = 0;         //mean yaw rate over the span, rad/s
+  double yawRateVariance = 0; //of the mean yaw rate
+  boost::array<double, 3> acc = {{0, 0, 0}};    //mean acceleration, m/s^2
+  boost::array<double, 9> accCovariance = {{}}; //of the mean acceleration, row major
+
+  /**
+   * Yaw turned at the mean rate over an interval, the odometry frame's dt rather than the span
+   * of the samples that happened to arrive in time for it
+   */
+  double yawOver(const double dt) const { return yawRate * dt; }
+
+  /**
+   * Variance of yawOver
+   */
+  double yawVarianceOver(const double dt) const { return yawRateVariance * dt * dt; }
+};
+
+/**
+ * Accumulates IMU samples between odometry frames, so each frame gets the yaw the gyro
+ * integrated and the mean acceleration over all of them instead of one instantaneous reading.
+ * The sampling thread adds samples to running sums and publishes them through a seqlock; the
+ * odometry thread takes the difference since its last take. Neither ever waits for the other.
+ */
+class imuPreintegrator
+{
+  public:
+    explicit imuPreintegrator(const imuNoise &noise = imuNoise()): noise_(noise) {}
+
+    /**
+     * Adds a bias corrected sample. Only call from one producer thread.
+     * @param stamp   When it was measured in seconds
+     * @param yawRate Yaw rate in rad/s
+     * @param acc     Acceleration along x, y and z in m/s^2
+     */
+    void add(const double stamp, const double yawRate, const double acc[3]);
+
+    /**
+     * Takes what the samples added since the last take measured. Only call from one consumer
+     * thread.
+     * @param  window Filled with the samples since the last take
+     * @return        False if no sample was added since
+     */
+    bool take(imuPreintegration *window);
+
+  private:
+    const imuNoise noise_;
+
+    //Longest gap between samples that is integrated, a stalled sampler doesn't mean the rate held
+    static constexpr double maxSampleGap = 0.05;
+
+    imuIntegral sums_;        //producer only
+    seqlock<imuIntegral> published_;
+    imuIntegral taken_;       //consumer only
+    bool takenValid_ = false; //consumer only
+};
+
+#endif
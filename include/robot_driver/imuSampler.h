@@ -0,0 +1,195 @@
+#ifndef imuSampler_h
+#define imuSampler_h
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <boost/array.hpp>
+#include <ros/ros.h>
+#include <sensor_msgs/Imu.h>
+
+#include "robot_driver/MPU6000.h"
+#include "robot_driver/imuCalibration.h"
+#include "robot_driver/imuFeed.h"
+#include "robot_driver/spscRing.h"
+#include "robot_driver/seqlock.h"
+#include "robot_driver/flightRecorder.h"
+#include "robot_driver/gpioEventSource.h"
+
+//IMU sample with the time it was measured
+struct imuSample
+{
+  ros::Time stamp;
+  mpu6000_sample data;
+};
+
+//How to reach and run the IMU
+struct imuSamplerConfig
+{
+  std::string spiBackend = "spidev"; //see createSpiTransport
+  int csChannel = 0;
+  long speed = 500000;
+  bool useFifo = false; //drain the hardware FIFO instead of reading one sample per period
+  std::string dataReadyChip; //GPIO chip the INT pin is wired to, or "sim", see createGpioEventSource. Sampled on a timer when empty
+  int dataReadyLine = 0;
+  std::string calibrationFile; //where the bias and chip setup are kept between runs, not kept when empty
+  bool warmStart = true; //use the saved calibration instead of resetting and calibrating at startup
+  bool replay = false; //leave the chip alone, samples come from replaySample instead
+  imuNoise noise; //how much to trust the samples integrated between odometry frames
+};
+
+class imuSampler
+{
+  public:
+    /**
+     * Initializes and calibrates the MPU6000. Blocks until calibration is done, unless a saved
+     * calibration can be used.
+     * @param config SPI backend and sampling mode
+     */
+    imuSampler(const imuSamplerConfig &config);
+    ~imuSampler();
+
+    /**
+     * Records every sample from now on. Call before start.
+     * @param recorder Recorder that outlives the sampling thread, or nullptr to stop recording
+     */
+    void setRecorder(flightRecorder *recorder) { recorder_ = recorder; }
+
+    /**
+     * Starts the sampling thread, does nothing when replaying
+     */
+    void start();
+
+    /**
+     * Stops and joins the sampling thread, then saves the refined calibration
+     */
+    void stop();
+
+    /**
+     * Hands over a recorded sample as if the sampling thread had read it. Only call when
+     * replaying, and from one thread.
+     * @param sample Recorded IMU sample
+     */
+    void replaySample(const imuSample &sample) { push(sample, 0); }
+
+    /**
+     * Starts over from a recorded bias model. Only call when replaying, from the same thread
+     * as replaySample.
+     * @param model Recorded bias model
+     */
+    void replayBias(const imuBiasModel &model);
+
+    /**
+     * Removes the oldest sample waiting to be published. Only call from one consumer thread.
+     * @param  sample Filled with the sample
+     * @return        False if no sample is waiting
+     */
+    bool pop(imuSample *sample) { return ring_.pop(sample); }
+
+    /**
+     * What the odometry reads: the newest sample, the bias refined while the robot stands still
+     * and every sample pre-integrated since the last frame
+     */
+    imuFeed &feed() { return feed_; }
+
+    /**
+     * Number of samples dropped because the consumer fell behind
+     */
+    unsigned long getOverruns() const { return overruns_.load(std::memory_order_relaxed); }
+
+    /**
+     * Number of samples lost on the chip: thrown away when the FIFO overflowed, or announced by
+     * data ready edges that came faster than the samples could be read and overwritten
+     */
+    unsigned long getMissedSamples() const { return missedSamples_.load(std::memory_order_relaxed); }
+
+    /**
+     * Fills an IMU message from a sample, removing bias and rotating into base_link
+     * @param sample IMU sample
+     * @param imu    IMU message to fill
+     */
+    void fillImu(const imuSample &sample, sensor_msgs::Imu *imu) const;
+
+  private:
+    std::unique_ptr<spiTransport> spi_;
+    mpu6000 imu_;
+    const bool useFifo_, replay_;
+
+    //Saved calibration is used within this many °C of the temperatures it has seen
+    static constexpr float maxCachedTemperatureChange = 5;
+
+    const std::string calibrationFile_;
+    imuCalibration calibration_; //chip state to save with the bias
+
+    //The sampling thread's working copy of the bias, published through feed_
+    imuBiasModel trackedBias_;
+    imuBiasTracker biasTracker_;
+
+    //Two seconds of samples at the default 500Hz sample rate
+    static const size_t ringCapacity = 1024;
+    spscRing<imuSample, ringCapacity> ring_;
+
+    //Newest sample, bias and every sample for the odometry to fuse once per frame
+    imuFeed feed_;
+
+    //Drain the FIFO after this many samples, well before its 73 sample capacity is reached
+    static const int fifoDrainSamples = 8;
+    static const int fifoSampleCapacity = FIFO_SIZE / FIFO_SAMPLE_SIZE;
+    boost::array<mpu6000_sample, fifoSampleCapacity> fifoSamples_;
+
+    //Data ready edges, none when sampling on a timer
+    std::unique_ptr<gpioEventSource> dataReady_;
+    static const int dataReadyTimeoutMs = 100;
+
+    flightRecorder *recorder_ = nullptr;
+
+    std::atomic<bool> running_{false};
+    std::atomic<unsigned long> overruns_{0}, missedSamples_{0};
+    std::thread thread_;
+
+    const boost::array<float, 9> emptyIMUCov = {{0, 0, 0, 0, 0, 0, 0, 0, 0}};
+
+    /**
+     * Adopts the chip configuration from a saved calibration if the chip still has it
+     * @param  cached Saved calibration
+     * @return        True if the chip needs no initialization
+     */
+    bool resume(const imuCalibration &cached);
+
+    /**
+     * Estimates the bias at the current temperature from a short burst of samples, assuming the
+     * robot stands still. Keeps the model's slope.
+     */
+    void calibrate();
+
+    /**
+     * Saves the current bias if there is a calibration file
+     */
+    void saveCalibration();
+
+    /**
+     * Sampling thread main loop
+     */
+    void run();
+
+    /**
+     * Pushes every sample in the FIFO
+     * @param samplePeriod Seconds between samples
+     */
+    void drainFifo(const double samplePeriod);
+
+    /**
+     * Reads and pushes the sample in the sensor registers
+     */
+    void readSample();
+
+    /**
+     * Hands a sample to the consumer and makes it the latest one
+     * @param sample      IMU sample
+     * @param monotonicNs When it was measured on the steady clock in nanoseconds, for the recorder
+     */
+    void push(const imuSample &sample, const int64_t monotonicNs);
+};
+
+#endif
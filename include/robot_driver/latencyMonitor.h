@@ -0,0 +1,96 @@
+#ifndef latencyMonitor_h
+#define latencyMonitor_h
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <boost/array.hpp>
+
+//Only fillDiagnostics needs the message, so marking stages doesn't pull in ROS
+namespace diagnostic_msgs
+{
+  template <class ContainerAllocator> struct DiagnosticStatus_;
+  typedef DiagnosticStatus_<std::allocator<void> > DiagnosticStatus;
+}
+
+typedef std::chrono::steady_clock monotonicClock;
+
+/**
+ * Lock-free log-linear histogram of durations. Any thread can record while another takes
+ * summaries; a summary resets the histogram.
+ */
+class latencyHistogram
+{
+  public:
+    //Quantiles in microseconds over the samples since the last summary
+    struct summary
+    {
+      uint64_t count;
+      double p50, p99, max;
+    };
+
+    latencyHistogram(): maxMicros_(0)
+    {
+      for (std::atomic<uint32_t> &bucket : buckets_)
+        bucket.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Adds a duration
+     * @param duration Duration to add
+     */
+    void record(const monotonicClock::duration duration);
+
+    /**
+     * Returns quantiles of everything recorded since the last call and starts over
+     */
+    summary takeSummary();
+
+  private:
+    //Four buckets per power of two of microseconds, up to about 16 s
+    static const int subBuckets = 4;
+    static const int bucketCount = subBuckets * 24;
+
+    boost::array<std::atomic<uint32_t>, bucketCount> buckets_;
+    std::atomic<uint64_t> maxMicros_;
+
+    static int bucketFor(const uint64_t micros);
+    static double bucketMidpoint(const int bucket);
+};
+
+/**
+ * Timestamps each frame at every stage between its bytes arriving on the cortex UART and its
+ * odometry being published, and keeps a histogram per stage
+ */
+class latencyMonitor
+{
+  public:
+    enum stage { arrival, headerSync, payloadComplete, imuRead, odometryDone, published, stageCount };
+
+    /**
+     * Timestamps a stage of the current frame
+     * @param s    Stage
+     * @param time When it happened
+     */
+    void mark(const stage s, const monotonicClock::time_point time = monotonicClock::now()) { marks_[s] = time; }
+
+    /**
+     * Records the current frame's stage durations. Call once its odometry is published.
+     */
+    void frameDone();
+
+    /**
+     * Fills a diagnostic status with p50/p99/max per stage since the last call
+     * @param status Status to fill
+     */
+    void fillDiagnostics(diagnostic_msgs::DiagnosticStatus *status);
+
+  private:
+    boost::array<monotonicClock::time_point, stageCount> marks_;
+
+    //Duration of each stage from the previous one, plus arrival to published
+    boost::array<latencyHistogram, stageCount> histograms_;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef mpcEncoder_h
+#define mpcEncoder_h
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "robot_driver/cortexFrameParser.h"
+
+//An object for the cortex to pick up, in the field frame
+struct mpcObject
+{
+  double x = 0, y = 0; //m
+  uint8_t kind = 0;    //passed through from the point's z
+};
+
+/*
+ * MPC reply payloads. Protocol version 1 is the original fixed 27 bytes: three slots of x and y
+ * in mm as int32 then the kind, unused slots all 0xFF. Version 2 is length prefixed: the number
+ * of bytes after the prefix, the object count, the robot's x and y in mm as int16, then per
+ * object x and y relative to the robot in mm as zigzag varints and the kind. Objects near the
+ * robot take 5 bytes instead of 9, and there can be as many as fit in a frame. Multi-byte
+ * values are little endian.
+ */
+static const int mpcLegacyObjects = 3;
+static const int mpcLegacySlotLength = 9;
+static const int mpcLegacyLength = mpcLegacyObjects * mpcLegacySlotLength;
+static const int mpcCompactHeaderLength = 6;
+
+//Smallest object in a version 2 payload: x and y within 63 mm of the robot take a byte each
+static const int mpcMinObjectLength = 3;
+
+//Most objects a version 2 payload can hold, if every one is that close. How many of a real list
+//fit depends on where they are, encodeMpcCompact stops at the first one that doesn't.
+static const int mpcMaxObjects = (cortexFrame::maxPayloadLength - mpcCompactHeaderLength) / mpcMinObjectLength;
+
+//Both encodings of one object list, the version spoken decides which one goes out
+struct mpcMessage
+{
+  uint8_t legacy[mpcLegacyLength];
+  uint8_t compactLength;
+  uint8_t compact[cortexFrame::maxPayloadLength];
+  uint8_t legacyCount, compactCount; //objects each encoding holds
+  uint32_t inputCount;               //objects there were to send, those the sent encoding lacks are dropped
+};
+
+/**
+ * Encodes objects the way protocol version 1 sends them
+ * @param  objects Objects
+ * @param  count   Number of objects
+ * @param  data    Filled with mpcLegacyLength bytes
+ * @return         Number of objects encoded, at most mpcLegacyObjects
+ */
+int encodeMpcLegacy(const mpcObject *objects, const int count, uint8_t *data);
+
+/**
+ * Encodes objects the way protocol version 2 sends them
+ * @param  objects Objects
+ * @param  count   Number of objects
+ * @param  robotX  Robot x in the field frame in m
+ * @param  robotY  Robot y in the field frame in m
+ * @param  data    Filled with the payload, room for cortexFrame::maxPayloadLength bytes
+ * @param  length  Set to the payload length
+ * @return         Number of objects encoded, fewer than count if the rest don't fit
+ */
+int encodeMpcCompact(const mpcObject *objects, const int count, const double robotX, const double robotY,
+                     uint8_t *data, size_t *length);
+
+/**
+ * Encodes objects both ways
+ * @param objects Objects
+ * @param count   Number of objects
+ * @param robotX  Robot x in the field frame in m
+ * @param robotY  Robot y in the field frame in m
+ * @param message Filled with both encodings
+ */
+void encodeMpcMessage(const mpcObject *objects, const int count, const double robotX, const double robotY,
+                      mpcMessage *message);
+
+/**
+ * Decodes an MPC payload, as the cortex would
+ * @param  data     Payload
+ * @param  length   Payload length
+ * @param  version  Protocol version it was encoded for
+ * @param  objects  Filled with the objects
+ * @param  capacity Room in objects
+ * @param  count    Set to the number of objects
+ * @return          False if the payload is malformed or holds more than capacity objects
+ */
+bool decodeMpcObjects(const uint8_t *data, const size_t length, const int version, mpcObject *objects,
+                      const int capacity, int *count);
+
+#endif
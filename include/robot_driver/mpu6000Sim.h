@@ -0,0 +1,62 @@
+#ifndef mpu6000Sim_h
+#define mpu6000Sim_h
+
+#include <chrono>
+#include <random>
+#include <stdint.h>
+#include <boost/array.hpp>
+
+#include "robot_driver/spiTransport.h"
+
+/**
+ * In-memory MPU6000 SPI backend for running the driver without the chip. It models the register file,
+ * burst reads with address auto increment, the sample rate divider and the FIFO, and
+ * produces a level, stationary IMU with a small gyro bias and noise.
+ */
+class mpu6000Sim : public spiTransport
+{
+  public:
+    mpu6000Sim();
+
+    void transfer(uint8_t *data, const size_t length) override;
+
+  private:
+    boost::array<uint8_t, 128> regs_;
+
+    boost::array<uint8_t, 1024> fifo_;
+    int fifoHead_ = 0, fifoCount_ = 0;
+    bool fifoOverflow_ = false;
+
+    bool pendingRead_ = false;
+    uint8_t pendingReg_ = 0;
+
+    std::chrono::steady_clock::time_point lastSample_;
+    std::mt19937 rng_;
+    std::normal_distribution<float> noise_;
+
+    /**
+     * Puts every register back to its power on value
+     */
+    void reset();
+
+    /**
+     * Generates the samples the chip would have taken since the last transaction
+     */
+    void update();
+
+    /**
+     * Reads one byte for a read transaction
+     * @param  reg Register address, incremented unless it is the FIFO port
+     * @return     Register value
+     */
+    uint8_t readByte(uint8_t *reg);
+
+    /**
+     * Writes one register, applying side effects like resets
+     * @param reg   Register address
+     * @param value New value
+     */
+    void writeByte(const uint8_t reg, const uint8_t value);
+};
+
+#endif
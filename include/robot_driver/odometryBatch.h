@@ -0,0 +1,58 @@
+#ifndef odometryBatch_h
+#define odometryBatch_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "robot_driver/diffDriveOdometry.h"
+
+//A whole integrated trajectory as columns, one entry per step
+struct odometryTrajectory
+{
+  std::vector<double> x, y, theta;                    //pose after each step, meters and radians
+  std::vector<double> linearVelocity, angularVelocity; //m/s and rad/s over each step
+};
+
+/**
+ * Integrates logged quad counts a whole trajectory at a time, with the same arcs as
+ * diffDriveOdometry. The counts are turned into per-step wheel sums and differences once when
+ * loaded, so integrating them again with other conversions only scales those columns, takes a
+ * prefix sum of the turns for the heading and one of the chords for the position. Each stage is
+ * a plain loop over contiguous columns; the compiler vectorises all but the one calling sin and
+ * cos. Loaded counts are never changed by integrate, so threads can share one batch.
+ */
+class odometryBatch
+{
+  public:
+    /**
+     * Takes a log of counts, the first entry is only the starting point like after a reset
+     * @param leftCounts  Cumulative left quad counts
+     * @param rightCounts Cumulative right quad counts
+     * @param dts         Time since the previous entry in seconds
+     * @param count       Entries in each column
+     */
+    void load(const int32_t *leftCounts, const int32_t *rightCounts, const double *dts, const size_t count);
+
+    /**
+     * Number of steps integrate produces, one less than the entries loaded
+     */
+    size_t steps() const { return rate_.size(); }
+
+    /**
+     * Integrates every step
+     * @param geometry   Conversions to use, the noise isn't needed
+     * @param trajectory Filled with the trajectory, its columns are reused between calls
+     * @param x          Starting X position in meters
+     * @param y          Starting Y position in meters
+     * @param theta      Starting heading in radians
+     */
+    void integrate(const diffDriveGeometry &geometry, odometryTrajectory *trajectory,
+                   const double x = 0, const double y = 0, const double theta = 0) const;
+
+  private:
+    //Per step sums and differences of the wheel deltas, halved, and one over the step's dt
+    std::vector<double> halfSum_, halfDiff_, rate_;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef robotDriver_h
+#define robotDriver_h
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+#include <ros/ros.h>
+
+#include "robot_driver/robotPOS.h"
+
+/**
+ * The whole driver: a robotPOS, the RX thread that publishes its odometry and the thread that
+ * publishes its IMU samples. Every message is published as a fresh boost::shared_ptr and never
+ * touched again, so subscribers in the same process, such as a nodelet EKF, get it without
+ * serialisation. Hosted by the robot_driver node and by the robot_driver/driver nodelet.
+ */
+class robotDriver
+{
+  public:
+    /**
+     * Reads the /robot_driver parameters, opens the port or flight record and starts publishing
+     * @param n Node handle to advertise on
+     * @throws boost::system::system_error if the port can't be opened
+     * @throws std::invalid_argument if a parameter is bad
+     */
+    explicit robotDriver(ros::NodeHandle &n);
+
+    ~robotDriver();
+
+    /**
+     * Stops the threads. Safe to call more than once.
+     */
+    void stop();
+
+    /**
+     * Whether the RX thread has finished, because a replay is done or the serial link failed.
+     * After a failure the driver's other threads have stopped too.
+     */
+    bool isDone() const { return done_; }
+
+    /**
+     * Whether reading from or writing to the cortex failed while running
+     */
+    bool failed() const { return failed_; }
+
+    /**
+     * Why the link failed, only valid once isDone is true
+     */
+    const std::string& failure() const { return failure_; }
+
+  private:
+    boost::asio::io_service io_;
+    std::unique_ptr<robotPOS> robot_;
+
+    ros::Publisher odomPub_, imuPub_, frameImuPub_, filterFix_;
+    double imuRate_ = 100;
+
+    //Every odometry a replay publishes, at full precision so two replays can be compared byte for byte
+    std::ofstream replayLog_;
+
+    std::atomic<bool> running_{true}, done_{false}, failed_{false};
+    std::string failure_; //written by the RX thread before done_ is set
+    std::thread rxThread_, imuThread_;
+
+    /**
+     * RX thread main loop: waits for serial reads and publishes every frame they held
+     */
+    void runRx();
+
+    /**
+     * Stops the driver after the link failed and reports why, from the RX thread
+     * @param reason What failed
+     */
+    void fail(const std::string &reason);
+
+    /**
+     * IMU thread main loop: publishes samples on their own schedule so a stalled serial link can't starve them
+     */
+    void runImu();
+
+    /**
+     * Tells the EKF to start from the origin
+     */
+    void publishInitialPose();
+};
+
+#endif
@@ -35,30 +35,119 @@
 #include <nav_msgs/Odometry.h>
 #include <sensor_msgs/Imu.h>
 #include <geometry_msgs/Point32.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <tf/transform_listener.h>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <string>
+#include <fstream>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <ros/spinner.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/PointCloud.h>
 #include <std_msgs/UInt16.h>
+#include <std_msgs/UInt8MultiArray.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
-#include "robot_driver/MPU6000.h"
+#include "robot_driver/imuSampler.h"
+#include "robot_driver/cortexFrameParser.h"
+#include "robot_driver/cortexReceiver.h"
+#include "robot_driver/latencyMonitor.h"
+#include "robot_driver/diffDriveOdometry.h"
+#include "robot_driver/flightRecorder.h"
+#include "robot_driver/mpcEncoder.h"
+#include "robot_driver/seqlock.h"
+#include "robot_driver/spscRing.h"
 
+/*
+ * Talks to the cortex from four threads. The thread running io is the RX thread: it runs the
+ * reads and calls poll. robotPOS writes to the port from its own TX thread, the only one that
+ * does. Its subscriptions and timers run on a callback queue with one spinner thread of their own, so
+ * they never wait for the UART and never overlap each other. The IMU is sampled on the
+ * imuSampler's thread.
+ */
 class robotPOS
 {
   public:
-    robotPOS(const std::string& port, const uint32_t baud_rate, boost::asio::io_service& io, const int csChannel, const long speed);
-    ~robotPOS() {};
+    robotPOS(const std::string& port, const uint32_t baud_rate, boost::asio::io_service& io, const imuSamplerConfig& imuConfig,
+             const diffDriveGeometry& geometry);
+    ~robotPOS();
 
     /**
-      * Poll the laser to get a new scan. Blocks until a complete new scan is received or close is called.
-      * @param scan LaserScan message pointer to fill in with the scan. The caller is responsible for filling in the ROS timestamp and frame_id
+     * Stops the callbacks, the TX thread and the IMU sampling. Call from the RX thread once it
+     * has stopped polling, or from any thread once it has exited. Safe to call more than once.
+     */
+    void stop();
+
+    /**
+     * Whether writing to the cortex failed. The TX thread has then exited and the RX thread's
+     * io_service is woken so it sees this.
+     */
+    bool txFailed() const { return txFailed_.load(std::memory_order_acquire); }
+
+    /**
+     * Why writing to the cortex failed, only valid once txFailed is true
+     */
+    const std::string& txError() const { return txError_; }
+
+    /**
+     * Publishes the cortex link as failed on /diagnostics. Call after stop, the diagnostics
+     * timer no longer runs then.
+     * @param reason What failed
+     */
+    void reportFailure(const std::string &reason);
+
+    /**
+      * Parse received cortex data to get new odometry. Never blocks; reads complete while the
+      * io_service runs. Call until it returns false, one call may leave more frames for the next.
+      * Only call from the RX thread.
+      * @param odom Odometry message to fill in, stamped with the estimated time the cortex measured it
+      * @return     True if odom was filled
       */
-    bool poll(nav_msgs::Odometry *odom, sensor_msgs::Imu *imu);
+    bool poll(nav_msgs::Odometry *odom);
+
+    /**
+     * Takes the oldest IMU sample the sampling thread has queued. Only call from one thread.
+     * @param  imu IMU message to fill, stamped with the measurement time
+     * @return     False if no sample is waiting
+     */
+    bool popImu(sensor_msgs::Imu *imu);
 
     /**
-     * Callback function for sending ekf position estimate to cortex
+     * Takes what the IMU measured over the frame from the last successful poll: the mean yaw
+     * rate and acceleration of every sample since the frame before, with their variances. Only
+     * call from the RX thread.
+     * @param  imu IMU message to fill, stamped like the odometry
+     * @return     False if no sample arrived during the frame, or it was already taken
+     */
+    bool popFrameImu(sensor_msgs::Imu *imu);
+
+    /**
+     * Tells the latency monitor the odometry from the last successful poll was published
+     */
+    void odomPublished();
+
+    /**
+     * Whether the node plays back a flight record instead of talking to the robot
+     */
+    bool isReplaying() const { return replaying_; }
+
+    /**
+     * Recorded time played back per second, 0 for as fast as possible
+     */
+    double getReplayRate() const { return replayRate_; }
+
+    /**
+     * Whether a replay has handed out every frame of its session
+     */
+    bool isReplayDone() const { return replayDone_ && rxOffset_ == rxLength_; }
+
+    /**
+     * Callback function for the ekf position estimate, keeps it for forwardPose to send to the cortex
      */
     void ekf_callback(const nav_msgs::Odometry::ConstPtr& in);
 
@@ -75,54 +164,133 @@ class robotPOS
     std::string port_; //serial port
     uint32_t baud_rate_; //serial baud rate
 
-    //odom math
-    const float straightConversion = 0.716457354, thetaConversion = 0.00270938;
+    //When the cortex measured the last std frame, to stamp what the IMU measured over it
+    ros::Time frameImuStamp_;
 
-    mpu6000 imu_;
-    double channel0Bias = 0, channel1Bias = 0, channel2Bias =0, channel2RotBias = 0; //imu constant offsets measured at init time
+    //Variance for the axes a robot on the floor can't move in
+    static constexpr double planarVariance = 1e-6;
 
-    static const uint8_t std_msg_type = 1, mpc_msg_type = 2;
+    //Raw serial bytes and IMU samples, declared before imu_ so it outlives the sampling thread
+    flightRecorder recorder_;
+
+    imuSampler imu_;
+
+    static const uint8_t std_msg_type = 1, mpc_msg_type = 2, version_msg_type = 3;
 
     //Lengths for recieved messages
-    static const uint8_t std_msg_length = 10, mpc_msg_length = 0;
+    static const uint8_t std_msg_length = 10, mpc_msg_length = 0, version_msg_length = 1;
 
-    static const int msgType_Count = 2;
-    const boost::array<uint8_t, msgType_Count> msgTypes = {{std_msg_type, mpc_msg_type}};
-    bool isFirstMsg = true;
-    boost::array<uint8_t, msgType_Count> msgCounts = {{0, 0}};
+    static const int msgType_Count = 3;
+    const boost::array<uint8_t, msgType_Count> msgTypes = {{std_msg_type, mpc_msg_type, version_msg_type}};
+    boost::array<uint8_t, msgType_Count> msgCounts = {{0, 0, 0}}; //last count sent per type, TX thread only
 
-    boost::asio::serial_port serial_; // UART port for the Cortex
+    //Framing agreed with the cortex, see cortexFrameParser. Version 1 until the cortex answers a
+    //hello, firmware that doesn't know the hello never does.
+    static const int maxProtocolVersion = 2;
+    static constexpr double helloPeriod = 0.5;
+    static const int helloAttempts = 10;
+    std::atomic<int> protocolVersion_{1};
+    int requestedVersion_ = maxProtocolVersion, hellosSent_ = 0;
+    std::atomic<bool> versionAgreed_{false}; //set by the RX thread, stops the hello timer
+    ros::Timer helloTimer_;
 
-    ros::Time prevTime; //previous time of last poll
+    boost::asio::io_service &rxIo_; //runs serial_'s reads on the RX thread
+    boost::asio::serial_port serial_; // UART port for the Cortex read by the RX thread, left closed when replaying
+
+    //Messages for the cortex on their way to the TX thread, which numbers and frames them. Each
+    //sending thread has its own queue so every queue has one producer.
+    struct txMessage
+    {
+      uint8_t type, length;
+      boost::array<uint8_t, cortexFrame::maxPayloadLength> payload;
+    };
+    static const size_t txRingSize = 16;
+    typedef spscRing<txMessage, txRingSize> txRing;
+    txRing rxSends_, callbackSends_; //answers to the cortex from the RX thread, poses and hellos from callbacks
+    std::atomic<unsigned> txPending_{0}; //messages queued and not yet written
+    std::atomic<unsigned long> txDropped_{0};
+    std::atomic<bool> txFailed_{false};
+    std::string txError_; //written by the TX thread before txFailed_ is set
+
+    //The TX thread writes a duplicate of the port's descriptor through its own io_service
+    boost::asio::io_service txIo_;
+    boost::asio::serial_port txPort_;
+    std::unique_ptr<boost::asio::io_service::work> txWork_;
+    std::thread txThread_;
+
+    //Frames waiting to be written, each built whole in a preallocated slot. Frames queued while a
+    //write is in flight go out together in the next one. TX thread only.
+    static const size_t txQueueSize = 16;
+    struct txSlot
+    {
+      boost::array<uint8_t, cortexFrameParser::maxFrameLength> data;
+      size_t length;
+    };
+    boost::array<txSlot, txQueueSize> txQueue_;
+    uint64_t txTail_ = 0, txHead_ = 0; //oldest queued and next free slot, counting every frame queued
+    size_t txWriting_ = 0; //slots from txTail_ on that the write in flight holds
+    std::vector<boost::asio::const_buffer> txBuffers_;
+
+    //Flight record played back in place of the serial port, its IMU samples in place of the chip
+    const bool replaying_;
+    double replayRate_ = 1;
+    flightRecordReader replay_;
+    flightRecordView replayRecord_; //next record, waiting until it is due when replayPending_
+    bool replayPending_ = false, replayDone_ = false;
+    int64_t replayStartNs_ = 0; //recorded monotonic time of the first record
+    monotonicClock::time_point replayStart_; //when the first record was played
+
+    //Received bytes waiting to be parsed
+    static const size_t rxBufferSize = 4096;
+    boost::array<uint8_t, rxBufferSize> rxBuffer_;
+    size_t rxLength_ = 0, rxOffset_ = 0;
+    bool readPending_ = false;
+    ros::Time rxStamp_; //time the bytes in rxBuffer_ arrived
+    monotonicClock::time_point rxArrival_; //same, on the monotonic clock for latency
+    std::ofstream clockLog_; //arrival,dt lines for clock_sync_bench when ~clock_log is set
+
+    //Per stage latency of each frame, the link's and the recorder's counters, published on /diagnostics
+    static constexpr double diagnosticsPeriod = 1.0;
+    latencyMonitor latency_;
+    unsigned long linkProblems_ = 0; //lost frames at the last publish
+    unsigned long imuProblems_ = 0; //lost IMU samples at the last publish
+    ros::Publisher diagnosticsPub_;
+    ros::Timer diagnosticsTimer_;
+    diagnostic_msgs::DiagnosticArray diagnostics_;
+    std::string failure_; //why the link failed, reported as an error once set
 
-    //Matrix format is x,y,z,rotx,roty,rotz
-    const boost::array<float, 36> ODOM_POSE_COV_MAT =
-    {{
-      0.0, 0,    0,    0,    0,    0,
-      0,    0.0, 0,    0,    0,    0,
-      0,    0,    0.0, 0,    0,    0,
-      0,    0,    0,    0.0, 0,    0,
-      0,    0,    0,    0,    0.0, 0,
-      0,    0,    0,    0,    0,    0.0
-    }}; //Odometry pose covariance matrix
-
-    //Matrix format is x,y,z,rotx,roty,rotz
-    const boost::array<float, 36> ODOM_TWIST_COV_MAT =
-    {{
-      0.0, 0,    0,    0,    0,    0,
-      0,    0.0, 0,    0,    0,    0,
-      0,    0,    0.0, 0,    0,    0,
-      0,    0,    0,    0.0, 0,    0,
-      0,    0,    0,    0,    0.0, 0,
-      0,    0,    0,    0,    0,    0.0
-    }}; //Odometry twist covariance matrix
-
-    const boost::array<float, 9> emptyIMUCov = {{0, 0, 0, 0, 0, 0, 0, 0, 0}};
+    //Frames, sequence counts, stamps and dead reckoning from the received bytes, RX thread only
+    cortexReceiver receiver_;
 
+    ros::Time prevTime; //previous time of last poll
+
+    //Subscriptions and timers, spun by their own thread once construction is done
+    ros::CallbackQueue callbacks_;
+    ros::AsyncSpinner spinner_;
     ros::NodeHandle n;
     ros::Publisher spcPub, cortexPub;
+    std_msgs::UInt8MultiArray cortexOut_; //raw frame bytes: type, count, payload
     ros::Subscriber ekfSub, mpcSub, lidarRPMSub;
 
+    //Latest ekf pose waiting to be sent to the cortex in the field frame, older ones are superseded
+    static constexpr double defaultEkfRate = 20;
+    double ekfRate_ = defaultEkfRate; //poses per second sent at most
+    ros::Timer ekfTimer_;
+    geometry_msgs::PoseStamped pendingPose_;
+    bool havePose_ = false;
+    unsigned long posesSent_ = 0, posesSuperseded_ = 0;
+
+    //The field frame only moves if field_static is false, otherwise it is looked up once
+    tf::TransformListener listener_;
+    bool fieldStatic_ = true, haveField_ = false;
+    tf::StampedTransform field_;
+    double fieldX_ = 0, fieldY_ = 0; //robot position in the last pose sent, in m
+
+    //Objects to pick up, encoded for both protocol versions by the callback and read whole when the
+    //cortex asks for them
+    seqlock<mpcMessage> mpcOut_;
+    std::atomic<unsigned long> mpcObjectsDropped_{0}; //objects left out of the replies sent, RX thread writes
+
     int currentLidarRPM = 250;
 
     //Next objects to pick up
@@ -131,9 +299,6 @@ class robotPOS
     //Whether the robot has picked up the last objects we sent it
     bool didPickUpObjects = false;
 
-    //Starting flag for sending a message to the cortex
-    const boost::array<uint8_t, 1> startFlag  = {{0xFA}};
-
     union long2Bytes { int32_t l; uint8_t b[4]; };
     long2Bytes conv;
 
@@ -145,16 +310,83 @@ class robotPOS
     inline const uint8_t getMsgLengthForType(const uint8_t type) const;
 
     /**
-     * Sends message header over UART
-     * @param type Type of message
+     * Starts an asynchronous read into the receive buffer
+     */
+    void startRead();
+
+    /**
+     * Called by the io_service when a read completes
+     * @param error             Read error
+     * @param bytesTransferred  Number of bytes read
+     */
+    void readHandler(const boost::system::error_code &error, const size_t bytesTransferred);
+
+    /**
+     * Moves the next recorded read into the receive buffer once it is due, first handing the
+     * IMU the samples recorded before it
+     * @return True if the buffer was filled
+     */
+    bool readReplay();
+
+    /**
+     * Handles one frame from the cortex
+     * @param  frame Received frame
+     * @param  odom  Odometry data
+     * @return       True if odom was filled
+     */
+    bool handleFrame(const cortexFrame &frame, nav_msgs::Odometry *odom);
+
+    /**
+     * Fills pose, twist and their covariances from the dead reckoning
+     * @param odom Odometry message
+     */
+    void fillOdometry(nav_msgs::Odometry *odom) const;
+
+    /**
+     * Publishes latency statistics gathered since the last call
+     */
+    void publishDiagnostics(const ros::TimerEvent &event);
+
+    /**
+     * Sends the latest ekf pose to the cortex in the field frame, once the last message has left
+     */
+    void forwardPose(const ros::TimerEvent &event);
+
+    /**
+     * Offers the cortex the newest protocol version, until it answers or enough attempts went unanswered
+     */
+    void sendHello(const ros::TimerEvent &event);
+
+    /**
+     * Hands a message for the cortex to the TX thread. Never blocks. A replay has no cortex to
+     * listen, it drops the message.
+     * @param queue   The calling thread's queue, rxSends_ or callbackSends_
+     * @param type    Type of message
+     * @param payload Payload bytes
+     * @param length  Number of payload bytes
+     */
+    void sendFrame(txRing *queue, const uint8_t type, const uint8_t *payload, const size_t length);
+
+    /**
+     * TX thread main loop, runs txIo_ until the driver shuts down
+     */
+    void runTx();
+
+    /**
+     * Frames queued messages into free slots and starts writing them unless a write is in flight.
+     * TX thread only.
+     */
+    void drainSends();
+
+    /**
+     * Writes every framed message with one gather write
      */
-    void sendMsgHeader(const uint8_t type);
+    void startWrite();
 
     /**
-     * Verifies a message header
-     * @param  count Message count
-     * @param  type  Message type
-     * @return       If header is valid
+     * Called by the io_service when a write completes
+     * @param error            Write error
+     * @param bytesTransferred Number of bytes written
      */
-    inline const bool verifyMsgHeader(const uint8_t type, const uint8_t count);
+    void writeHandler(const boost::system::error_code &error, const size_t bytesTransferred);
 };
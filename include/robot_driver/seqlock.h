@@ -0,0 +1,57 @@
+#ifndef seqlock_h
+#define seqlock_h
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Single-writer sequence lock. The writer never blocks; readers retry while a write is in
+ * progress, so they always get a consistent copy of the latest value.
+ */
+template <typename T>
+class seqlock
+{
+  static_assert(std::is_trivially_copyable<T>::value, "seqlock value must be trivially copyable");
+
+  public:
+    /**
+     * Replaces the value. Only call from the writer thread.
+     * @param value New value
+     */
+    void store(const T &value)
+    {
+      const unsigned seq = seq_.load(std::memory_order_relaxed);
+      seq_.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      std::memcpy(&value_, &value, sizeof(T));
+
+      seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * Returns a copy of the latest value. Safe from any thread.
+     */
+    T load() const
+    {
+      T copy;
+      unsigned before, after;
+
+      do
+      {
+        before = seq_.load(std::memory_order_acquire);
+        std::memcpy(&copy, &value_, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = seq_.load(std::memory_order_relaxed);
+      } while ((before & 1) || before != after);
+
+      return copy;
+    }
+
+  private:
+    std::atomic<unsigned> seq_{0};
+    T value_{};
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef spiTransport_h
+#define spiTransport_h
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+//One chip select cycle of a batched transfer, full duplex in place
+struct spiSegment
+{
+  uint8_t *data;
+  size_t length;
+};
+
+/**
+ * SPI bus the MPU6000 is on. Backends throw boost::system::system_error when the bus fails.
+ */
+class spiTransport
+{
+  public:
+    virtual ~spiTransport() {}
+
+    /**
+     * One transaction with chip select held for its whole length
+     * @param data   Bytes to send, replaced by the bytes received
+     * @param length Number of bytes
+     */
+    virtual void transfer(uint8_t *data, const size_t length) = 0;
+
+    /**
+     * Several transactions with chip select released between them. Backends that can queue
+     * them in one system call override this.
+     * @param segments Transactions in order
+     * @param count    Number of transactions
+     */
+    virtual void transfer(spiSegment *segments, const size_t count)
+    {
+      for (size_t i = 0; i < count; i++)
+        transfer(segments[i].data, segments[i].length);
+    }
+};
+
+/**
+ * Creates an SPI backend
+ * @param  backend "spidev", "wiringpi" (when built with WiringPi) or "sim" for the in-memory MPU6000
+ * @param  channel Chip select channel
+ * @param  speed   Clock speed in Hz
+ * @return         The backend
+ */
+std::unique_ptr<spiTransport> createSpiTransport(const std::string &backend, const int channel, const long speed);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef spidevTransport_h
+#define spidevTransport_h
+
+#include "robot_driver/spiTransport.h"
+
+/**
+ * SPI through the kernel spidev driver. Batched transfers go to the kernel as one
+ * SPI_IOC_MESSAGE ioctl.
+ */
+class spidevTransport : public spiTransport
+{
+  public:
+    /**
+     * Opens /dev/spidev0.<channel> in mode 0
+     * @param channel Chip select channel
+     * @param speed   Clock speed in Hz
+     */
+    spidevTransport(const int channel, const long speed);
+    ~spidevTransport();
+
+    void transfer(uint8_t *data, const size_t length) override;
+    void transfer(spiSegment *segments, const size_t count) override;
+
+  private:
+    //Most transfers spidev accepts in one message with its default buffer size
+    static const size_t maxSegmentsPerMessage = 32;
+
+    int fd_;
+    uint32_t speed_;
+};
+
+#endif
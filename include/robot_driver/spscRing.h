@@ -0,0 +1,68 @@
+#ifndef spscRing_h
+#define spscRing_h
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Lock-free ring buffer for exactly one producer thread and one consumer thread.
+ * Capacity must be a power of two; one slot is never used so a full ring can be told
+ * apart from an empty one.
+ */
+template <typename T, size_t Capacity>
+class spscRing
+{
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "spscRing capacity must be a power of two");
+
+  public:
+    /**
+     * Adds an element. Only call from the producer thread.
+     * @param  item Element to add
+     * @return      False if the ring is full and the element was dropped
+     */
+    bool push(const T &item)
+    {
+      const size_t head = head_.load(std::memory_order_relaxed);
+      const size_t next = (head + 1) & (Capacity - 1);
+
+      if (next == tail_.load(std::memory_order_acquire))
+        return false;
+
+      buffer_[head] = item;
+      head_.store(next, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * Removes the oldest element. Only call from the consumer thread.
+     * @param  item Filled with the removed element
+     * @return      False if the ring is empty
+     */
+    bool pop(T *item)
+    {
+      const size_t tail = tail_.load(std::memory_order_relaxed);
+
+      if (tail == head_.load(std::memory_order_acquire))
+        return false;
+
+      *item = buffer_[tail];
+      tail_.store((tail + 1) & (Capacity - 1), std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * Number of elements waiting, exact only when called from the consumer thread
+     */
+    size_t size() const
+    {
+      return (head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire)) & (Capacity - 1);
+    }
+
+  private:
+    //Keep the indices on their own cache lines so producer and consumer don't false share
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) T buffer_[Capacity];
+};
+
+#endif
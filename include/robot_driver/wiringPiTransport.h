@@ -0,0 +1,24 @@
+#ifndef wiringPiTransport_h
+#define wiringPiTransport_h
+
+#include "robot_driver/spiTransport.h"
+
+/**
+ * SPI through WiringPi, kept for boards set up for it
+ */
+class wiringPiTransport : public spiTransport
+{
+  public:
+    /**
+     * @param channel Chip select channel
+     * @param speed   Clock speed in Hz
+     */
+    wiringPiTransport(const int channel, const long speed);
+
+    void transfer(uint8_t *data, const size_t length) override;
+
+  private:
+    int channel_;
+};
+
+#endif
@@ -1,13 +1,45 @@
 #include "robot_driver/MPU6000.h"
-#include <wiringPiSPI.h>
 #include <iostream>
 #include <unistd.h>
 
 
-mpu6000::mpu6000(int csChannel, long speed)
+mpu6000::mpu6000(spiTransport &spi):
+spi_(spi)
 {
-  channel = csChannel;
-  wiringPiSPISetup(channel, speed);
+}
+
+/*-----------------------------------------------------------------------------------------------
+                                SCALE DIVIDERS
+usage: internal, LSBs per G or per Degree per second for an ACCEL_CONFIG or GYRO_CONFIG value
+-----------------------------------------------------------------------------------------------*/
+static float acc_divider_for(int scale)
+{
+  switch (scale & BITS_FS_MASK)
+  {
+    case BITS_FS_2G:
+      return 16384;
+    case BITS_FS_4G:
+      return 8192;
+    case BITS_FS_8G:
+      return 4096;
+    default:
+      return 2048;
+  }
+}
+
+static float gyro_divider_for(int scale)
+{
+  switch (scale & BITS_FS_MASK)
+  {
+    case BITS_FS_250DPS:
+      return 131;
+    case BITS_FS_500DPS:
+      return 65.5;
+    case BITS_FS_1000DPS:
+      return 32.8;
+    default:
+      return 16.4;
+  }
 }
 
 /*-----------------------------------------------------------------------------------------------
@@ -28,17 +60,24 @@ returns 1 if an error occurred
 unsigned char mpu6000::write(unsigned char dataIn)
 {
   unsigned char buff[1] = {dataIn};
-  wiringPiSPIDataRW (channel, buff, 1);
+  spi_.transfer(buff, 1);
   return buff[0];
 }
 
 unsigned char mpu6000::writeReg(unsigned char reg, unsigned char value)
 {
 	unsigned char buf[2] = {reg, value};
-	wiringPiSPIDataRW(channel, buf, 2);
+	spi_.transfer(buf, 2);
 	return buf[0];
 }
 
+unsigned char mpu6000::readReg(unsigned char reg)
+{
+	unsigned char buf[2] = {(unsigned char)(reg | READ_FLAG), 0x00};
+	spi_.transfer(buf, 2);
+	return buf[1];
+}
+
 void mpu6000::wakeup()
 {
 	unsigned char response;
@@ -89,18 +128,77 @@ bool mpu6000::init(int sample_rate_div,int low_pass_filter)
 
   if (response < 100) { return 0; } //COULDN'T RECEIVE WHOAMI
 
-  //SET SAMPLE RATE
-  writeReg(MPUREG_SMPLRT_DIV, sample_rate_div);
-
-  // FS & DLPF
-  writeReg(MPUREG_CONFIG, low_pass_filter);
+  //SET SAMPLE RATE, FS & DLPF, DISABLE INTERRUPTS
+  unsigned char config[3][2] =
+  {
+    {MPUREG_SMPLRT_DIV, (unsigned char)sample_rate_div},
+    {MPUREG_CONFIG, (unsigned char)low_pass_filter},
+    {MPUREG_INT_ENABLE, 0x00}
+  };
+  spiSegment segments[3] = {{config[0], 2}, {config[1], 2}, {config[2], 2}};
+  spi_.transfer(segments, 3);
 
-  //DISABLE INTERRUPTS
-  writeReg(MPUREG_INT_ENABLE, 0x00);
+  sample_rate_div_ = sample_rate_div;
+  low_pass_filter_ = low_pass_filter;
 
   return 0;
 }
 
+/*-----------------------------------------------------------------------------------------------
+                                READ CONFIGURATION
+usage: call this function to read back the registers init and the scale setters configure, with
+one SPI transaction for the contiguous SMPLRT_DIV to ACCEL_CONFIG block and one for PWR_MGMT_1
+returns the register values
+-----------------------------------------------------------------------------------------------*/
+mpu6000_config mpu6000::read_config()
+{
+  unsigned char block[5] = {MPUREG_SMPLRT_DIV | READ_FLAG, 0x00, 0x00, 0x00, 0x00};
+  unsigned char power[2] = {MPUREG_PWR_MGMT_1 | READ_FLAG, 0x00};
+  spiSegment segments[2] = {{block, 5}, {power, 2}};
+  spi_.transfer(segments, 2);
+
+  mpu6000_config config;
+  config.smplrt_div = block[1];
+  config.config = block[2];
+  config.gyro_config = block[3];
+  config.accel_config = block[4];
+  config.pwr_mgmt_1 = power[1];
+
+  return config;
+}
+
+/*-----------------------------------------------------------------------------------------------
+                                RESUME
+usage: call this function instead of init and the scale setters when the chip may still be set
+up from an earlier run, giving the configuration read_config returned back then. If the chip is
+awake and configured the same way, the driver adopts that configuration without resetting the
+chip and the FIFO is switched off until enable_fifo is called.
+returns true if the chip could be resumed, otherwise call init
+-----------------------------------------------------------------------------------------------*/
+bool mpu6000::resume(const mpu6000_config &expected)
+{
+  const mpu6000_config config = read_config();
+
+  if ((config.pwr_mgmt_1 & BIT_SLEEP) ||
+      config.smplrt_div != expected.smplrt_div ||
+      config.config != expected.config ||
+      config.gyro_config != expected.gyro_config ||
+      config.accel_config != expected.accel_config ||
+      config.pwr_mgmt_1 != expected.pwr_mgmt_1)
+  {
+    return false;
+  }
+
+  writeReg(MPUREG_USER_CTRL, BIT_I2C_IF_DIS);
+
+  sample_rate_div_ = config.smplrt_div;
+  low_pass_filter_ = config.config;
+  acc_divider = acc_divider_for(config.accel_config);
+  gyro_divider = gyro_divider_for(config.gyro_config);
+
+  return true;
+}
+
 /*-----------------------------------------------------------------------------------------------
                                 ACCELEROMETER SCALE
 usage: call this function at startup, after initialization, to set the right range for the
@@ -117,24 +215,7 @@ unsigned int mpu6000::set_acc_scale(int scale)
 
   writeReg(MPUREG_ACCEL_CONFIG, scale);
 
-  switch (scale)
-  {
-    case BITS_FS_2G:
-      acc_divider = 16384;
-      break;
-    case BITS_FS_4G:
-      acc_divider = 8192;
-      break;
-    case BITS_FS_8G:
-      acc_divider = 4096;
-      break;
-    case BITS_FS_16G:
-      acc_divider = 2048;
-      break;
-    default:
-      acc_divider = 2048;
-      break;
-    }
+  acc_divider = acc_divider_for(scale);
 
   usleep(10000);
 
@@ -180,24 +261,7 @@ unsigned int mpu6000::set_gyro_scale(int scale)
 
   writeReg(MPUREG_GYRO_CONFIG, scale);
 
-  switch (scale)
-  {
-    case BITS_FS_250DPS:
-        gyro_divider = 131;
-        break;
-    case BITS_FS_500DPS:
-        gyro_divider = 65.5;
-        break;
-    case BITS_FS_1000DPS:
-        gyro_divider = 32.8;
-        break;
-    case BITS_FS_2000DPS:
-        gyro_divider = 16.4;
-        break;
-  	default:
-    	gyro_divider = 16.4;
-    	break;
-  }
+  gyro_divider = gyro_divider_for(scale);
 
 	usleep(10000);
 
@@ -368,6 +432,149 @@ float mpu6000::read_temp()
   return data;
 }
 
+/*-----------------------------------------------------------------------------------------------
+                                READ ALL SENSORS
+usage: call this function to read accelerometer, temperature and gyroscope data in one SPI
+transaction. The registers from ACCEL_XOUT_H to GYRO_ZOUT_L are contiguous, so a single read
+command followed by 14 dummy bytes returns all of them from the same sample instant.
+returns the raw register values and the values in Gs, °C and Degrees per second
+-----------------------------------------------------------------------------------------------*/
+mpu6000_sample mpu6000::read_all()
+{
+  unsigned char buf[FIFO_SAMPLE_SIZE + 1] = {MPUREG_ACCEL_XOUT_H | READ_FLAG};
+  mpu6000_sample sample;
+
+  spi_.transfer(buf, FIFO_SAMPLE_SIZE + 1);
+
+  // buf[0] is clocked out while the register address is sent
+  decode_sample(&buf[1], &sample);
+
+  return sample;
+}
+
+/*-----------------------------------------------------------------------------------------------
+                                DECODE SAMPLE
+usage: internal, converts FIFO_SAMPLE_SIZE big endian bytes laid out like the registers from
+ACCEL_XOUT_H to GYRO_ZOUT_L into a sample
+-----------------------------------------------------------------------------------------------*/
+void mpu6000::decode_sample(const unsigned char *data, mpu6000_sample *sample)
+{
+  for (int axis = 0; axis < 3; axis++)
+  {
+    sample->raw_acc[axis] = (int16_t)((data[axis * 2] << 8) | data[axis * 2 + 1]);
+    sample->raw_rot[axis] = (int16_t)((data[8 + axis * 2] << 8) | data[8 + axis * 2 + 1]);
+
+    sample->acc[axis] = (float)sample->raw_acc[axis] / (float)acc_divider;
+    sample->rot[axis] = (float)sample->raw_rot[axis] / (float)gyro_divider;
+  }
+
+  sample->raw_temp = (int16_t)((data[6] << 8) | data[7]);
+  sample->temp = ((float)sample->raw_temp / 340.0) + 36.53;
+}
+
+/*-----------------------------------------------------------------------------------------------
+                                FIFO
+usage: call enable_fifo after initialization and after setting the scales. From then on the chip
+pushes accel, temperature and gyro words into its 1024 byte FIFO at the sample rate set in init.
+Call read_fifo periodically to drain every complete sample in one SPI transaction; the oldest
+sample is written to samples[0].
+returns the number of samples read, 0 if the FIFO was empty. When it had overflowed it is reset,
+because the sample boundaries are lost, and minus the number of samples thrown away is returned;
+more were overwritten before that, so it is a lower bound of what was lost.
+-----------------------------------------------------------------------------------------------*/
+void mpu6000::enable_fifo()
+{
+  unsigned char regs[3][2] =
+  {
+    {MPUREG_FIFO_EN, BIT_TEMP_FIFO_EN | BIT_XG_FIFO_EN | BIT_YG_FIFO_EN | BIT_ZG_FIFO_EN | BIT_ACCEL_FIFO_EN},
+    {MPUREG_USER_CTRL, BIT_I2C_IF_DIS | BIT_FIFO_RESET},
+    {MPUREG_USER_CTRL, BIT_I2C_IF_DIS | BIT_FIFO_EN}
+  };
+  spiSegment segments[3] = {{regs[0], 2}, {regs[1], 2}, {regs[2], 2}};
+  spi_.transfer(segments, 3);
+}
+
+/*-----------------------------------------------------------------------------------------------
+                                DATA READY INTERRUPT
+usage: call enable_data_ready_interrupt after initialization to have the INT pin pulse high for
+50us every time a new sample is in the sensor registers, at the sample rate set in init. Wire the
+pin to a GPIO line and wait for its rising edges instead of polling on a timer. The pulse clears
+itself, so nothing has to be read to acknowledge it.
+-----------------------------------------------------------------------------------------------*/
+void mpu6000::enable_data_ready_interrupt()
+{
+  unsigned char regs[2][2] =
+  {
+    {MPUREG_INT_PIN_CFG, 0x00}, //active high, push-pull, 50us pulse
+    {MPUREG_INT_ENABLE, BIT_RAW_RDY_EN}
+  };
+  spiSegment segments[2] = {{regs[0], 2}, {regs[1], 2}};
+  spi_.transfer(segments, 2);
+}
+
+void mpu6000::reset_fifo()
+{
+  unsigned char regs[2][2] =
+  {
+    {MPUREG_USER_CTRL, BIT_I2C_IF_DIS | BIT_FIFO_RESET},
+    {MPUREG_USER_CTRL, BIT_I2C_IF_DIS | BIT_FIFO_EN}
+  };
+  spiSegment segments[2] = {{regs[0], 2}, {regs[1], 2}};
+  spi_.transfer(segments, 2);
+}
+
+unsigned int mpu6000::fifo_count()
+{
+  unsigned char buf[3] = {MPUREG_FIFO_COUNTH | READ_FLAG, 0x00, 0x00};
+  spi_.transfer(buf, 3);
+  return (buf[1] << 8) | buf[2];
+}
+
+int mpu6000::read_fifo(mpu6000_sample *samples, int max_samples)
+{
+  unsigned char buf[FIFO_SIZE + 1];
+  const unsigned int count = fifo_count();
+
+  if (count >= FIFO_SIZE)
+  {
+    reset_fifo();
+    return -static_cast<int>(count / FIFO_SAMPLE_SIZE);
+  }
+
+  int sample_count = count / FIFO_SAMPLE_SIZE;
+  if (sample_count > max_samples)
+    sample_count = max_samples;
+  if (sample_count == 0)
+    return 0;
+
+  const int length = sample_count * FIFO_SAMPLE_SIZE;
+  buf[0] = MPUREG_FIFO_R_W | READ_FLAG;
+  for (int i = 1; i <= length; i++)
+    buf[i] = 0x00;
+
+  // FIFO_R_W does not auto increment, every dummy byte pops the next FIFO byte
+  spi_.transfer(buf, length + 1);
+
+  for (int i = 0; i < sample_count; i++)
+    decode_sample(&buf[1 + i * FIFO_SAMPLE_SIZE], &samples[i]);
+
+  return sample_count;
+}
+
+/*-----------------------------------------------------------------------------------------------
+                                SAMPLE PERIOD
+usage: call this function after init to get the time between two samples
+returns the period in seconds
+-----------------------------------------------------------------------------------------------*/
+float mpu6000::sample_period()
+{
+  // Gyro output rate is 8kHz without the DLPF and 1kHz with it
+  const int low_pass = low_pass_filter_ & BITS_DLPF_CFG_MASK;
+  const float gyro_rate = (low_pass == BITS_DLPF_CFG_256HZ_NOLPF2 || low_pass == BITS_DLPF_CFG_2100HZ_NOLPF) ? 8000 : 1000;
+
+  return (1 + sample_rate_div_) / gyro_rate;
+}
+
 /*-----------------------------------------------------------------------------------------------
                                 READ ACCELEROMETER CALIBRATION
 usage: call this function to read accelerometer data. Axis represents selected axis:
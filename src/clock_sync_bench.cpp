@@ -0,0 +1,158 @@
+/**
+ * Compares stamping cortex frames with their arrival time against stamping them with
+ * cortexClock's estimate. Reads a log robot_driver writes when ~clock_log is set, one
+ * "arrival_sec,dt_ms,left,right" line per std frame, or generates frames with a drifting cortex clock
+ * and random serial delays when no file is given.
+ *
+ * Usage: clock_sync_bench [clock_log.csv]
+ *
+ * Reports the jitter of the stamp intervals against the cortex's dt for both, and for
+ * generated frames also the error against the true measurement times.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "robot_driver/cortexClock.h"
+
+struct frameRecord
+{
+  double arrival, dt, truth;
+};
+
+/**
+ * Simulates a minute of frames from a cortex whose clock runs 200 ppm fast, with 1 ms dt
+ * resolution, a 2 ms serial delay plus exponential jitter and the occasional long stall
+ */
+static std::vector<frameRecord> generateFrames()
+{
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> period(0.0145, 0.0155);
+  std::exponential_distribution<double> jitter(1 / 0.003);
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  std::vector<frameRecord> frames;
+  double truth = 100, lastDtTime = truth;
+
+  for (int i = 0; i < 4000; i++)
+  {
+    truth += period(rng);
+
+    //The cortex measures its period with its own clock and whole milliseconds
+    const double dtMs = std::round((truth - lastDtTime) * 1.0002 * 1000);
+    lastDtTime = truth;
+
+    double delay = 0.002 + jitter(rng);
+    if (uniform(rng) < 0.01)
+      delay += 0.02;
+
+    frames.push_back({truth + delay, dtMs / 1000, truth});
+  }
+
+  //Frames can't arrive out of order
+  for (size_t i = 1; i < frames.size(); i++)
+    frames[i].arrival = std::max(frames[i].arrival, frames[i - 1].arrival);
+
+  return frames;
+}
+
+static bool readFrames(const char *path, std::vector<frameRecord> *frames)
+{
+  FILE *in = std::fopen(path, "r");
+  if (in == nullptr)
+    return false;
+
+  double arrival, dtMs;
+  //Only the first two columns matter here
+  while (std::fscanf(in, "%lf,%lf%*[^\n]", &arrival, &dtMs) == 2)
+    frames->push_back({arrival, dtMs / 1000, NAN});
+
+  std::fclose(in);
+  return true;
+}
+
+/**
+ * Prints the standard deviation and 99th percentile magnitude of some errors in ms
+ */
+static void printStats(const char *name, std::vector<double> errors)
+{
+  if (errors.empty())
+    return;
+
+  double mean = 0;
+  for (const double error : errors)
+    mean += error;
+  mean /= errors.size();
+
+  double variance = 0;
+  for (double &error : errors)
+  {
+    error -= mean;
+    variance += error * error;
+    error = std::fabs(error);
+  }
+  variance /= errors.size();
+
+  std::sort(errors.begin(), errors.end());
+  std::printf("  %-28s std %8.3f ms  p99 %8.3f ms\n", name, 1000 * std::sqrt(variance), 1000 * errors[errors.size() * 99 / 100]);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<frameRecord> frames;
+
+  if (argc > 1)
+  {
+    if (!readFrames(argv[1], &frames))
+    {
+      std::fprintf(stderr, "clock_sync_bench: can't read %s\n", argv[1]);
+      return 1;
+    }
+  }
+  else
+  {
+    frames = generateFrames();
+  }
+
+  if (frames.size() < 2)
+  {
+    std::fprintf(stderr, "clock_sync_bench: need at least two frames\n");
+    return 1;
+  }
+
+  cortexClock clock;
+  std::vector<double> estimates;
+  for (const frameRecord &frame : frames)
+    estimates.push_back(clock.update(frame.arrival, frame.dt));
+
+  //Intervals between stamps should match the cortex's dts
+  std::vector<double> arrivalJitter, estimateJitter, arrivalError, estimateError;
+  for (size_t i = 1; i < frames.size(); i++)
+  {
+    arrivalJitter.push_back(frames[i].arrival - frames[i - 1].arrival - frames[i].dt);
+    estimateJitter.push_back(estimates[i] - estimates[i - 1] - frames[i].dt);
+
+    if (!std::isnan(frames[i].truth))
+    {
+      arrivalError.push_back(frames[i].arrival - frames[i].truth);
+      estimateError.push_back(estimates[i] - frames[i].truth);
+    }
+  }
+
+  std::printf("%zu frames, %s, final skew %.6f\n", frames.size(), argc > 1 ? argv[1] : "generated", clock.skew());
+  std::printf("interval jitter against cortex dt:\n");
+  printStats("arrival stamps", arrivalJitter);
+  printStats("estimated stamps", estimateJitter);
+
+  if (!arrivalError.empty())
+  {
+    std::printf("error against true measurement time (mean removed):\n");
+    printStats("arrival stamps", arrivalError);
+    printStats("estimated stamps", estimateError);
+  }
+
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+
+#include "robot_driver/cortexClock.h"
+
+//Bound to std::min's reference parameter in update
+const int cortexClock::windowSize;
+
+cortexClock::cortexClock(const double maxError):
+maxError_(maxError)
+{
+}
+
+/**
+* Adds a frame and estimates when it was measured
+* @param  arrival Host time the frame arrived in seconds
+* @param  dt      Cortex time since the previous frame in seconds
+* @return         Host time the frame was measured in seconds
+*/
+double cortexClock::update(const double arrival, const double dt)
+{
+  //The host clock jumped backwards
+  if (count_ > 0 && arrival < lastArrival_ - maxError_)
+    reset();
+
+  cortexTime_ += dt;
+  lastArrival_ = arrival;
+
+  cortex_[head_] = cortexTime_;
+  host_[head_] = arrival;
+  head_ = (head_ + 1) % windowSize;
+  count_ = std::min(count_ + 1, windowSize);
+
+  if (count_ < minFrames)
+    return arrival;
+
+  //Fit host time against cortex time, relative to this frame to keep the sums small
+  double meanX = 0, meanY = 0;
+  for (int i = 0; i < count_; i++)
+  {
+    meanX += cortex_[i] - cortexTime_;
+    meanY += host_[i] - arrival;
+  }
+  meanX /= count_;
+  meanY /= count_;
+
+  double sxx = 0, sxy = 0;
+  for (int i = 0; i < count_; i++)
+  {
+    const double x = cortex_[i] - cortexTime_ - meanX, y = host_[i] - arrival - meanY;
+    sxx += x * x;
+    sxy += x * y;
+  }
+
+  const double slope = sxx > 1e-12 ? sxy / sxx : 1.0;
+  const double intercept = meanY - slope * meanX;
+
+  //Shift the line down to the least delayed frame
+  double minResidual = 0;
+  for (int i = 0; i < count_; i++)
+    minResidual = std::min(minResidual, host_[i] - arrival - (intercept + slope * (cortex_[i] - cortexTime_)));
+
+  //Never after this frame arrived, since this frame's own residual bounds the minimum
+  const double offset = intercept + minResidual;
+
+  //Far later than the cortex clock predicts, it probably restarted or stalled
+  if (-offset > maxError_)
+  {
+    reset();
+    cortexTime_ = dt;
+    lastArrival_ = arrival;
+    cortex_[0] = cortexTime_;
+    host_[0] = arrival;
+    head_ = count_ = 1;
+    return arrival;
+  }
+
+  skew_ = slope;
+  return arrival + offset;
+}
+
+/**
+* Forgets every frame, for example after the cortex restarts
+*/
+void cortexClock::reset()
+{
+  head_ = 0;
+  count_ = 0;
+  cortexTime_ = 0;
+  skew_ = 1;
+}
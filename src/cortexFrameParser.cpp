@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cstring>
+
+#include "robot_driver/cortexFrameParser.h"
+
+namespace
+{
+  struct crc16Table
+  {
+    uint16_t entries[256];
+
+    crc16Table()
+    {
+      for (uint32_t i = 0; i < 256; i++)
+      {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++)
+          crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        entries[i] = crc;
+      }
+    }
+  };
+
+  const crc16Table table;
+}
+
+/**
+* CRC-16/CCITT-FALSE (polynomial 0x1021, no reflection) of some bytes
+* @param  data   Bytes
+* @param  length Number of bytes
+* @param  crc    CRC of the bytes before, to continue it
+* @return        CRC
+*/
+uint16_t cortexCrc16(const uint8_t *data, const size_t length, const uint16_t crc)
+{
+  uint16_t c = crc;
+  for (size_t i = 0; i < length; i++)
+    c = (c << 8) ^ table.entries[((c >> 8) ^ data[i]) & 0xFF];
+  return c;
+}
+
+/**
+* Builds a whole frame: start flag, type, count, payload and, from protocol version 2 on, its checksum
+* @param  type    Message type
+* @param  count   Message count
+* @param  payload Payload bytes
+* @param  length  Number of payload bytes
+* @param  version Protocol version
+* @param  out     Filled with the frame
+* @return         Frame length
+*/
+size_t buildCortexFrame(const uint8_t type, const uint8_t count, const uint8_t *payload, const size_t length,
+                        const int version, uint8_t *out)
+{
+  out[0] = cortexFrameParser::startFlag;
+  out[1] = type;
+  out[2] = count;
+  std::memcpy(&out[cortexFrameParser::headerLength], payload, length);
+  size_t size = cortexFrameParser::headerLength + length;
+
+  if (version >= 2)
+  {
+    const uint16_t crc = cortexCrc16(&out[1], size - 1);
+    out[size++] = crc & 0xFF;
+    out[size++] = crc >> 8;
+  }
+
+  return size;
+}
+
+cortexFrameParser::cortexFrameParser()
+{
+  payloadLengths_.fill(0);
+  known_.fill(false);
+  prefixed_.fill(false);
+}
+
+/**
+* Sets the payload length for a message type
+* @param type   Message type
+* @param length Payload length
+*/
+void cortexFrameParser::setPayloadLength(const uint8_t type, const uint8_t length)
+{
+  payloadLengths_[type] = length;
+  known_[type] = true;
+  prefixed_[type] = false;
+}
+
+/**
+* Makes a message type's payload start with the number of payload bytes after that first byte
+* @param type Message type
+*/
+void cortexFrameParser::setLengthPrefixed(const uint8_t type)
+{
+  payloadLengths_[type] = 0;
+  known_[type] = true;
+  prefixed_[type] = true;
+}
+
+/**
+* Parses bytes until a frame is complete or the bytes run out
+* @param  data   Received bytes
+* @param  length Number of received bytes
+* @param  frame  Set to the completed frame, or nullptr if more bytes are needed
+* @return        Number of bytes consumed
+*/
+size_t cortexFrameParser::parse(const uint8_t *data, const size_t length, const cortexFrame **frame)
+{
+  size_t index = 0;
+  *frame = nullptr;
+
+  while (*frame == nullptr)
+  {
+    //A rejected frame's bytes come before anything newer
+    if (backlogOffset_ < backlogLength_)
+      backlogOffset_ += scan(&backlog_[backlogOffset_], backlogLength_ - backlogOffset_, frame);
+    else if (index < length)
+      index += scan(&data[index], length - index, frame);
+    else
+      break;
+
+    if (rejected_)
+      resync();
+  }
+
+  return index;
+}
+
+/**
+* Runs the state machine over bytes until a frame is complete, one is rejected, or the bytes run out
+* @return Number of bytes consumed
+*/
+size_t cortexFrameParser::scan(const uint8_t *data, const size_t length, const cortexFrame **frame)
+{
+  size_t index = 0;
+
+  while (index < length && *frame == nullptr && !rejected_)
+  {
+    switch (state_)
+    {
+      case waitStart:
+      {
+        //Skip straight to the next start byte instead of looking at every byte
+        const void *start = std::memchr(&data[index], startFlag, length - index);
+        const size_t found = start == nullptr ? length : static_cast<const uint8_t *>(start) - data;
+        skip(found - index);
+
+        if (start == nullptr)
+          return length;
+
+        if (skipping_)
+        {
+          statistics_.resyncs++;
+          skipping_ = false;
+        }
+
+        index = found + 1;
+        state_ = readType;
+        break;
+      }
+
+      case readType:
+      {
+        frame_.type = data[index++];
+        frame_.length = payloadLengths_[frame_.type];
+        received_ = 0;
+
+        if (!known_[frame_.type])
+        {
+          statistics_.unknownType++;
+          rejected_ = true;
+          break;
+        }
+
+        state_ = readCount;
+        break;
+      }
+
+      case readCount:
+      {
+        frame_.count = data[index++];
+
+        if (prefixed_[frame_.type])
+          state_ = readLength;
+        else if (frame_.length > 0)
+          state_ = readPayload;
+        else if (version_ >= 2)
+          state_ = readCrc;
+        else
+          finish(frame);
+        break;
+      }
+
+      case readLength:
+      {
+        //The prefix is part of the payload, a frame can't hold more than 254 bytes after it
+        frame_.payload[0] = data[index++];
+        frame_.length = std::min(frame_.payload[0] + 1, int(cortexFrame::maxPayloadLength));
+        received_ = 1;
+        state_ = readPayload;
+
+        if (frame_.payload[0] + 1 > cortexFrame::maxPayloadLength)
+        {
+          statistics_.corrupt++;
+          rejected_ = true;
+        }
+        else if (received_ == frame_.length)
+        {
+          received_ = 0;
+          if (version_ >= 2)
+            state_ = readCrc;
+          else
+            finish(frame);
+        }
+        break;
+      }
+
+      case readPayload:
+      {
+        //Copy as much of the payload as this chunk holds
+        const size_t count = std::min(length - index, frame_.length - received_);
+        std::memcpy(&frame_.payload[received_], &data[index], count);
+        index += count;
+        received_ += count;
+
+        if (received_ == frame_.length)
+        {
+          received_ = 0;
+          if (version_ >= 2)
+            state_ = readCrc;
+          else
+            finish(frame);
+        }
+        break;
+      }
+
+      case readCrc:
+      {
+        crc_[received_++] = data[index++];
+
+        if (received_ == crcLength)
+          finish(frame);
+        break;
+      }
+    }
+  }
+
+  return index;
+}
+
+/**
+* Hands out the current frame if its checksum is right, rejects it otherwise
+*/
+void cortexFrameParser::finish(const cortexFrame **frame)
+{
+  if (version_ >= 2)
+  {
+    const uint8_t header[2] = {frame_.type, frame_.count};
+    const uint16_t crc = cortexCrc16(&frame_.payload[0], frame_.length, cortexCrc16(header, 2));
+
+    if (crc != (crc_[0] | crc_[1] << 8))
+    {
+      statistics_.corrupt++;
+      rejected_ = true;
+      return;
+    }
+  }
+
+  state_ = waitStart;
+  statistics_.frames++;
+  *frame = &frame_;
+}
+
+/**
+* Queues the bytes of the rejected frame after its start flag to be parsed again
+*/
+void cortexFrameParser::resync()
+{
+  //Rebuild the bytes the frame took, the start flag itself is known to be wrong
+  boost::array<uint8_t, maxFrameLength> taken;
+  size_t count = 0;
+
+  taken[count++] = frame_.type;
+  if (state_ != readType)
+  {
+    taken[count++] = frame_.count;
+    const size_t payload = state_ == readPayload ? received_ : frame_.length;
+    std::memcpy(&taken[count], &frame_.payload[0], payload);
+    count += payload;
+    if (state_ == readCrc)
+    {
+      std::memcpy(&taken[count], &crc_[0], received_);
+      count += received_;
+    }
+  }
+
+  //Only a start flag can begin the next frame, everything before it is skipped right here
+  const void *start = std::memchr(&taken[0], startFlag, count);
+  const size_t from = start == nullptr ? count : static_cast<const uint8_t *>(start) - &taken[0];
+  skip(from + 1);
+
+  //Put them in front of whatever the backlog still holds
+  const size_t keep = count - from, remaining = backlogLength_ - backlogOffset_;
+  std::memmove(&backlog_[keep], &backlog_[backlogOffset_], remaining);
+  std::memcpy(&backlog_[0], &taken[from], keep);
+  backlogOffset_ = 0;
+  backlogLength_ = keep + remaining;
+
+  state_ = waitStart;
+  received_ = 0;
+  rejected_ = false;
+}
+
+/**
+* Counts bytes skipped while looking for a start flag
+*/
+void cortexFrameParser::skip(const size_t count)
+{
+  if (count == 0)
+    return;
+
+  statistics_.skippedBytes += count;
+  skipping_ = true;
+}
+
+/**
+* Drops any partially received frame and waits for the next start flag
+*/
+void cortexFrameParser::reset()
+{
+  state_ = waitStart;
+  received_ = 0;
+  backlogOffset_ = backlogLength_ = 0;
+  rejected_ = false;
+}
@@ -0,0 +1,130 @@
+#include <cstring>
+
+#include "robot_driver/cortexReceiver.h"
+
+cortexReceiver::cortexReceiver(const diffDriveGeometry &geometry, imuFeed &imu, latencyMonitor &latency):
+odometry_(geometry),
+imu_(imu),
+latency_(latency)
+{
+  counts_.fill(0);
+  countValid_.fill(false);
+}
+
+/**
+* Parses received bytes up to the end of the next frame
+* @param  data    Received bytes
+* @param  length  Number of bytes
+* @param  arrival When the bytes arrived, on the monotonic clock
+* @param  frame   Set to the completed frame, valid until the next call, or nullptr
+* @return         Number of bytes consumed
+*/
+size_t cortexReceiver::parse(const uint8_t *data, const size_t length, const monotonicClock::time_point arrival,
+                             const cortexFrame **frame)
+{
+  const bool wasIdle = parser_.idle();
+  const monotonicClock::time_point parseStart = monotonicClock::now();
+
+  const size_t consumed = parser_.parse(data, length, frame);
+  linkStatistics_.store(parser_.getStatistics());
+
+  //A frame started in this chunk
+  if (wasIdle && (*frame != nullptr || !parser_.idle()))
+  {
+    latency_.mark(latencyMonitor::arrival, arrival);
+    latency_.mark(latencyMonitor::headerSync, parseStart);
+  }
+
+  if (*frame != nullptr)
+  {
+    latency_.mark(latencyMonitor::payloadComplete);
+
+    //The quads are totals, so a lost std frame only makes the next delta span two frames
+    missedFrames_.fetch_add(sequenceGap((*frame)->type, (*frame)->count), std::memory_order_relaxed);
+  }
+
+  return consumed;
+}
+
+/**
+* Stamps a std frame and integrates it into the odometry
+* @param frame   Std frame from parse
+* @param arrival When its bytes arrived on the host clock in seconds
+* @param values  Filled with what the frame held
+*/
+void cortexReceiver::handleStd(const cortexFrame &frame, const double arrival, cortexStdFrame *values)
+{
+  //A byte robotPOS ignores, the left and right quads as RobotC longs and dt in ms
+  std::memcpy(&values->leftQuad, &frame.payload[1], 4);
+  std::memcpy(&values->rightQuad, &frame.payload[5], 4);
+
+  //Unsigned so a stalled frame's 128 ms or more doesn't turn negative
+  values->dt = frame.payload[9];
+  if (values->dt == 0)
+    values->dt = 15;
+  const double dt = values->dt / 1000.0;
+
+  values->stamp = clock_.update(arrival, dt);
+
+  //The sampling thread keeps this fresh even if the serial link stalled
+  const mpu6000_sample latest = imu_.latest();
+
+  //Every sample since the last frame, taken even when tipped so the next window starts here
+  frameImuValid_ = imu_.takePreintegration(&frameImu_);
+  latency_.mark(latencyMonitor::imuRead);
+
+  //Assume we are not moving if we tipped backwards, gravity then no longer all shows on Z
+  values->tipped = latest.acc[2] < 0.95 * imu_.getBias(latest.temp).acc[2];
+  if (values->tipped)
+  {
+    odometry_.hold(values->leftQuad, values->rightQuad);
+  }
+  else if (fuseYaw_ && frameImuValid_)
+  {
+    //The samples rarely cover the frame exactly, their mean rate does
+    odometry_.update(values->leftQuad, values->rightQuad, dt, frameImu_.yawOver(dt), frameImu_.yawVarianceOver(dt));
+  }
+  else
+  {
+    odometry_.update(values->leftQuad, values->rightQuad, dt);
+  }
+}
+
+/**
+* Takes what the IMU measured over the last std frame
+* @param  window Filled with the samples since the frame before
+* @return        False if no sample arrived during the frame, or it was already taken
+*/
+bool cortexReceiver::takeFrameImu(imuPreintegration *window)
+{
+  if (!frameImuValid_)
+    return false;
+
+  frameImuValid_ = false;
+  *window = frameImu_;
+  return true;
+}
+
+/**
+* Counts the frames of a type lost since the last one received
+* @param  type  Message type
+* @param  count Message count
+* @return       Number of frames missing before this one
+*/
+int cortexReceiver::sequenceGap(const uint8_t type, const uint8_t count)
+{
+  const uint8_t last = counts_[type];
+  const bool valid = countValid_[type];
+  counts_[type] = count;
+  countValid_[type] = true;
+
+  if (!valid)
+    return 0;
+
+  //Counts wrap after 254 like sendFrame's on the original firmware, after 255 under version 2
+  const int modulus = parser_.getVersion() > 1 ? 256 : 255;
+  const int gap = ((int(count) - last - 1) % modulus + modulus) % modulus;
+
+  //A jump back is a restarted cortex rather than a lot of lost frames
+  return gap < 128 ? gap : 0;
+}
@@ -0,0 +1,450 @@
+/**
+ * Cortex stand-in for running robot_driver without a robot. Opens a pseudo-terminal, links
+ * its slave end to ~link so robot_driver can use it as its port, and sends std frames either
+ * from a synthetic trajectory or from a raw capture of the cortex UART (for example made with
+ * cat /dev/cortexUSB > capture.bin). Every odometry message robot_driver publishes is matched
+ * to the frame that produced it to measure end-to-end latency and the sustained frame rate.
+ *
+ * Private parameters:
+ *   link         path of the symlink to the pty slave (/tmp/cortexSim)
+ *   capture_file raw capture to play back, synthetic trajectory when empty
+ *   rate         frames per second, 0 sends as fast as robot_driver accepts them (66.7)
+ *   frames       number of frames to send, 0 plays the whole capture or runs until shutdown (0)
+ *   left_speed   synthetic left wheel speed in quad counts per second (300)
+ *   right_speed  synthetic right wheel speed in quad counts per second (350)
+ *   dt           synthetic frame dt in ms sent to robot_driver (15)
+ *   mpc_every    send an mpc request every this many frames, 0 never (0)
+ *   protocol_version newest framing to agree to when robot_driver offers it, 1 acts like the
+ *                original firmware and ignores the offer (2)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <ros/ros.h>
+#include <nav_msgs/Odometry.h>
+
+#include "robot_driver/cortexFrameParser.h"
+#include "robot_driver/mpcEncoder.h"
+
+//Must match robotPOS
+constexpr uint8_t std_msg_type = 1, mpc_msg_type = 2, version_msg_type = 3;
+constexpr uint8_t std_msg_length = 10, mpc_msg_length = 0, version_msg_length = 1;
+
+//Messages robot_driver sends back
+constexpr uint8_t out_std_msg_length = 13, out_mpc_msg_length = mpcLegacyLength; //mpc is length prefixed from version 2 on
+
+typedef std::chrono::steady_clock simClock;
+
+class cortexSim
+{
+  public:
+    cortexSim(ros::NodeHandle &n, ros::NodeHandle &priv_nh);
+    ~cortexSim();
+
+    /**
+     * Sends every frame, then reports latency and throughput
+     */
+    void run();
+
+  private:
+    int master_ = -1, slave_ = -1;
+    std::string link_;
+
+    std::vector<uint8_t> capture_;
+    double rate_;
+    int frames_, mpcEvery_, maxVersion_;
+    double leftSpeed_, rightSpeed_;
+    int dt_;
+
+    ros::Subscriber odomSub_;
+
+    //Send times of frames robot_driver has not published odometry for yet
+    std::mutex pendingMutex_;
+    std::deque<simClock::time_point> pending_;
+    std::vector<double> latencies_;
+    simClock::time_point lastOdom_;
+
+    std::thread reader_;
+    std::atomic<bool> reading_{true};
+    std::atomic<unsigned long> stdReceived_{0}, mpcReceived_{0}, mpcObjects_{0};
+
+    //Framing of frames sent from now on, switched by the reader when robot_driver offers a newer one
+    std::mutex writeMutex_;
+    int version_ = 1;
+    uint8_t versionCount_ = 0;
+
+    /**
+     * Callback for odometry published by robot_driver
+     */
+    void odom_callback(const nav_msgs::Odometry::ConstPtr& in);
+
+    /**
+     * Drains and counts the messages robot_driver writes to the cortex
+     */
+    void readLoop();
+
+    /**
+     * Frames a message in the current protocol version and writes it to the pty
+     * @param type    Message type
+     * @param count   Message count
+     * @param payload Payload bytes
+     * @param length  Number of payload bytes
+     */
+    void sendFrame(const uint8_t type, const uint8_t count, const uint8_t *payload, const size_t length);
+
+    /**
+     * Answers robot_driver's hello in the current framing and switches to the version agreed on,
+     * with no other frame in between
+     * @param version Protocol version to switch to
+     */
+    void switchVersion(const uint8_t version);
+
+    /**
+     * Frames a message in the current protocol version and writes it, with writeMutex_ held
+     */
+    void sendFrameLocked(const uint8_t type, const uint8_t count, const uint8_t *payload, const size_t length);
+
+    /**
+     * Writes a whole frame to the pty
+     * @param data   Frame bytes
+     * @param length Number of bytes
+     */
+    void writeFrame(const uint8_t *data, const size_t length);
+};
+
+cortexSim::cortexSim(ros::NodeHandle &n, ros::NodeHandle &priv_nh)
+{
+  std::string captureFile;
+
+  priv_nh.param<std::string>("link", link_, "/tmp/cortexSim");
+  priv_nh.param<std::string>("capture_file", captureFile, "");
+  priv_nh.param("rate", rate_, 1000.0 / 15);
+  priv_nh.param("frames", frames_, 0);
+  priv_nh.param("left_speed", leftSpeed_, 300.0);
+  priv_nh.param("right_speed", rightSpeed_, 350.0);
+  priv_nh.param("dt", dt_, 15);
+  priv_nh.param("mpc_every", mpcEvery_, 0);
+  priv_nh.param("protocol_version", maxVersion_, 2);
+
+  if (!captureFile.empty())
+  {
+    std::ifstream in(captureFile, std::ios::binary);
+    if (!in)
+      throw std::runtime_error("cortex_sim: can't open capture " + captureFile);
+
+    capture_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    ROS_INFO("cortex_sim: playing back %zu bytes from %s", capture_.size(), captureFile.c_str());
+  }
+
+  //Open the pty pair and keep the slave open ourselves so it survives driver restarts
+  master_ = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_ < 0 || grantpt(master_) != 0 || unlockpt(master_) != 0)
+    throw std::runtime_error("cortex_sim: can't open pty");
+
+  const std::string slaveName = ptsname(master_);
+  slave_ = open(slaveName.c_str(), O_RDWR | O_NOCTTY);
+
+  termios tio;
+  tcgetattr(slave_, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave_, TCSANOW, &tio);
+
+  unlink(link_.c_str());
+  if (symlink(slaveName.c_str(), link_.c_str()) != 0)
+    throw std::runtime_error("cortex_sim: can't link " + link_);
+
+  ROS_INFO("cortex_sim: cortex is on %s (%s)", link_.c_str(), slaveName.c_str());
+
+  odomSub_ = n.subscribe<nav_msgs::Odometry>("robot_publisher/odom0", 1000, &cortexSim::odom_callback, this);
+
+  reader_ = std::thread(&cortexSim::readLoop, this);
+}
+
+cortexSim::~cortexSim()
+{
+  reading_ = false;
+  if (reader_.joinable())
+    reader_.join();
+
+  close(slave_);
+  close(master_);
+  unlink(link_.c_str());
+}
+
+/**
+* Sends every frame, then reports latency and throughput
+*/
+void cortexSim::run()
+{
+  ROS_INFO("cortex_sim: waiting for robot_driver");
+  while (ros::ok() && odomSub_.getNumPublishers() == 0)
+    usleep(100000);
+
+  //robot_driver calibrates its imu after advertising, give it a moment before timing frames
+  usleep(2000000);
+  ROS_INFO("cortex_sim: sending frames");
+
+  cortexFrameParser parser;
+  parser.setPayloadLength(std_msg_type, std_msg_length);
+  parser.setPayloadLength(mpc_msg_type, mpc_msg_length);
+  size_t captureOffset = 0;
+
+  boost::array<uint8_t, cortexFrame::maxPayloadLength> payload;
+  double leftQuad = 0, rightQuad = 0;
+  uint8_t stdCount = 0, mpcCount = 0;
+  int sent = 0;
+
+  const simClock::duration period = rate_ > 0 ? std::chrono::duration_cast<simClock::duration>(std::chrono::duration<double>(1.0 / rate_)) : simClock::duration::zero();
+  const simClock::time_point start = simClock::now();
+  simClock::time_point next = start;
+
+  while (ros::ok() && (frames_ == 0 || sent < frames_))
+  {
+    if (mpcEvery_ > 0 && sent > 0 && sent % mpcEvery_ == 0)
+      sendFrame(mpc_msg_type, mpcCount++, &payload[0], 0);
+
+    if (capture_.empty())
+    {
+      leftQuad += leftSpeed_ * dt_ / 1000.0;
+      rightQuad += rightSpeed_ * dt_ / 1000.0;
+
+      const int32_t left = leftQuad, right = rightQuad;
+
+      payload[0] = 0;
+      std::memcpy(&payload[1], &left, 4);
+      std::memcpy(&payload[5], &right, 4);
+      payload[9] = dt_;
+      sendFrame(std_msg_type, stdCount++, &payload[0], std_msg_length);
+    }
+    else
+    {
+      //Next std frame from the capture
+      const cortexFrame *frame = nullptr;
+      while (captureOffset < capture_.size() && (frame == nullptr || frame->type != std_msg_type))
+        captureOffset += parser.parse(&capture_[captureOffset], capture_.size() - captureOffset, &frame);
+
+      if (frame == nullptr || frame->type != std_msg_type)
+        break;
+
+      sendFrame(frame->type, frame->count, &frame->payload[0], frame->length);
+    }
+
+    sent++;
+
+    if (period != simClock::duration::zero())
+    {
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+  }
+
+  const double sendSeconds = std::chrono::duration<double>(simClock::now() - start).count();
+
+  //Let the last frames come through
+  for (int i = 0; i < 20 && ros::ok(); i++)
+  {
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex_);
+      if (pending_.empty())
+        break;
+    }
+    usleep(50000);
+  }
+
+  std::lock_guard<std::mutex> lock(pendingMutex_);
+
+  const double receiveSeconds = std::chrono::duration<double>(lastOdom_ - start).count();
+  ROS_INFO("cortex_sim: sent %d frames in %.3f s (%.1f frames/s)", sent, sendSeconds, sent / sendSeconds);
+  ROS_INFO("cortex_sim: received %zu odometry messages (%.1f /s), %zu missing", latencies_.size(),
+           receiveSeconds > 0 ? latencies_.size() / receiveSeconds : 0.0, pending_.size());
+  ROS_INFO("cortex_sim: robot_driver sent %lu std and %lu mpc messages with %lu objects", stdReceived_.load(),
+           mpcReceived_.load(), mpcObjects_.load());
+
+  if (!latencies_.empty())
+  {
+    std::sort(latencies_.begin(), latencies_.end());
+
+    double sum = 0;
+    for (const double latency : latencies_)
+      sum += latency;
+
+    ROS_INFO("cortex_sim: frame to odometry latency ms: mean %.3f p50 %.3f p99 %.3f max %.3f",
+             1000 * sum / latencies_.size(),
+             1000 * latencies_[latencies_.size() / 2],
+             1000 * latencies_[latencies_.size() * 99 / 100],
+             1000 * latencies_.back());
+  }
+}
+
+/**
+* Callback for odometry published by robot_driver
+*/
+void cortexSim::odom_callback(const nav_msgs::Odometry::ConstPtr& in)
+{
+  const simClock::time_point now = simClock::now();
+  std::lock_guard<std::mutex> lock(pendingMutex_);
+
+  //Published before we started timing
+  if (pending_.empty())
+    return;
+
+  latencies_.push_back(std::chrono::duration<double>(now - pending_.front()).count());
+  pending_.pop_front();
+  lastOdom_ = now;
+}
+
+/**
+* Frames a message in the current protocol version and writes it to the pty
+* @param type    Message type
+* @param count   Message count
+* @param payload Payload bytes
+* @param length  Number of payload bytes
+*/
+void cortexSim::sendFrame(const uint8_t type, const uint8_t count, const uint8_t *payload, const size_t length)
+{
+  std::lock_guard<std::mutex> lock(writeMutex_);
+  sendFrameLocked(type, count, payload, length);
+}
+
+/**
+* Answers robot_driver's hello in the current framing and switches to the version agreed on
+* @param version Protocol version to switch to
+*/
+void cortexSim::switchVersion(const uint8_t version)
+{
+  std::lock_guard<std::mutex> lock(writeMutex_);
+  sendFrameLocked(version_msg_type, versionCount_++, &version, version_msg_length);
+  version_ = version;
+}
+
+/**
+* Frames a message in the current protocol version and writes it, with writeMutex_ held
+*/
+void cortexSim::sendFrameLocked(const uint8_t type, const uint8_t count, const uint8_t *payload, const size_t length)
+{
+  boost::array<uint8_t, cortexFrameParser::maxFrameLength> out;
+  const size_t size = buildCortexFrame(type, count, payload, length, version_, &out[0]);
+  writeFrame(&out[0], size);
+}
+
+/**
+* Writes a whole frame to the pty
+* @param data   Frame bytes
+* @param length Number of bytes
+*/
+void cortexSim::writeFrame(const uint8_t *data, const size_t length)
+{
+  size_t written = 0;
+
+  while (written < length)
+  {
+    const ssize_t result = write(master_, data + written, length - written);
+    if (result < 0)
+      throw std::runtime_error("cortex_sim: pty write failed");
+    written += result;
+  }
+
+  if (data[1] == std_msg_type)
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    pending_.push_back(simClock::now());
+  }
+}
+
+/**
+* Drains and counts the messages robot_driver writes to the cortex
+*/
+void cortexSim::readLoop()
+{
+  cortexFrameParser parser;
+  parser.setPayloadLength(std_msg_type, out_std_msg_length);
+  parser.setPayloadLength(mpc_msg_type, out_mpc_msg_length);
+  parser.setPayloadLength(version_msg_type, version_msg_length);
+
+  uint8_t buffer[4096];
+
+  while (reading_)
+  {
+    pollfd pfd = {master_, POLLIN, 0};
+    if (::poll(&pfd, 1, 100) <= 0)
+      continue;
+
+    const ssize_t length = read(master_, buffer, sizeof(buffer));
+
+    //EIO just means robot_driver has the port closed at the moment
+    if (length <= 0)
+    {
+      usleep(10000);
+      continue;
+    }
+
+    size_t offset = 0;
+    while (offset < (size_t)length)
+    {
+      const cortexFrame *frame;
+      offset += parser.parse(&buffer[offset], length - offset, &frame);
+
+      if (frame != nullptr && frame->type == std_msg_type)
+        stdReceived_++;
+      else if (frame != nullptr && frame->type == mpc_msg_type)
+      {
+        //Decode like the cortex would, a reply it can't read counts as none
+        mpcObject objects[mpcMaxObjects];
+        int count;
+        if (decodeMpcObjects(&frame->payload[0], frame->length, parser.getVersion(), objects, mpcMaxObjects, &count))
+        {
+          mpcReceived_++;
+          mpcObjects_ += count;
+        }
+      }
+      else if (frame != nullptr && frame->type == version_msg_type && maxVersion_ > 1)
+      {
+        //Answer in the old framing, then both sides switch
+        const uint8_t version = std::min<int>(frame->payload[0], maxVersion_);
+        switchVersion(version);
+        parser.setVersion(version);
+        if (version >= 2)
+          parser.setLengthPrefixed(mpc_msg_type);
+        ROS_INFO("cortex_sim: switched to protocol version %d", int(version));
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "cortex_sim");
+  ros::NodeHandle n;
+  ros::NodeHandle priv_nh("~");
+
+  try
+  {
+    cortexSim sim(n, priv_nh);
+
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+
+    sim.run();
+
+    spinner.stop();
+    return 0;
+  }
+  catch (const std::runtime_error &ex)
+  {
+    ROS_ERROR("%s", ex.what());
+    return -1;
+  }
+}
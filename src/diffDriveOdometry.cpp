@@ -0,0 +1,169 @@
+#include <cmath>
+
+#include "robot_driver/diffDriveOdometry.h"
+
+diffDriveOdometry::diffDriveOdometry(const diffDriveGeometry &geometry):
+geometry_(geometry)
+{
+  reset();
+}
+
+/**
+* Sets the pose and forgets its uncertainty. The next counts only set the starting point.
+* @param x     X position in meters
+* @param y     Y position in meters
+* @param theta Heading in radians
+*/
+void diffDriveOdometry::reset(const double x, const double y, const double theta)
+{
+  primed_ = false;
+  leftDelta_ = rightDelta_ = 0;
+
+  x_ = x;
+  y_ = y;
+  theta_ = theta;
+  v_ = omega_ = 0;
+  gyroInnovation_ = 0;
+
+  poseCov_.fill(0);
+  twistCov_.fill(0);
+}
+
+/**
+* Moves by the counts since the last update
+* @param  leftCount  Cumulative left quad count
+* @param  rightCount Cumulative right quad count
+* @param  dt         Time since the last update in seconds
+* @return            False for the first counts after a reset, which only set the starting point
+*/
+bool diffDriveOdometry::update(const int32_t leftCount, const int32_t rightCount, const double dt)
+{
+  return integrate(leftCount, rightCount, dt, false, 0, 0);
+}
+
+/**
+* Moves by the counts since the last update, with the heading change fused with what a gyro
+* measured over the same step
+* @param  leftCount    Cumulative left quad count
+* @param  rightCount   Cumulative right quad count
+* @param  dt           Time since the last update in seconds
+* @param  gyroDtheta   Heading change the gyro integrated over dt in radians
+* @param  gyroVariance Variance of gyroDtheta
+* @return              False for the first counts after a reset, which only set the starting point
+*/
+bool diffDriveOdometry::update(const int32_t leftCount, const int32_t rightCount, const double dt,
+                               const double gyroDtheta, const double gyroVariance)
+{
+  return integrate(leftCount, rightCount, dt, true, gyroDtheta, gyroVariance);
+}
+
+/**
+* Moves by the counts since the last update, fusing the gyro when there is one
+*/
+bool diffDriveOdometry::integrate(const int32_t leftCount, const int32_t rightCount, const double dt,
+                                  const bool fuseGyro, const double gyroDtheta, const double gyroVariance)
+{
+  if (!primed_)
+  {
+    hold(leftCount, rightCount);
+    return false;
+  }
+
+  //Unsigned subtraction so the deltas survive the counters wrapping
+  leftDelta_ = static_cast<int32_t>(static_cast<uint32_t>(leftCount) - static_cast<uint32_t>(lastLeft_));
+  rightDelta_ = static_cast<int32_t>(static_cast<uint32_t>(rightCount) - static_cast<uint32_t>(lastRight_));
+  lastLeft_ = leftCount;
+  lastRight_ = rightCount;
+
+  const double metersPerCount = geometry_.straightConversion / 1000;
+  double ds = (leftDelta_ + rightDelta_) / 2.0 * metersPerCount,
+         dtheta = (rightDelta_ - leftDelta_) / 2.0 * geometry_.thetaConversion;
+
+  //Count variances, then the covariance of (ds, dtheta) they cause
+  const double varLeft = geometry_.countVariancePerCount * std::abs(leftDelta_) + geometry_.countQuantizationVariance,
+               varRight = geometry_.countVariancePerCount * std::abs(rightDelta_) + geometry_.countQuantizationVariance;
+  const double a = metersPerCount / 2, b = geometry_.thetaConversion / 2;
+  double qSS = a * a * (varLeft + varRight),
+         qST = a * b * (varRight - varLeft),
+         qTT = b * b * (varLeft + varRight);
+
+  //Kalman update of (ds, dtheta) with the gyro measuring dtheta
+  gyroInnovation_ = 0;
+  if (fuseGyro && gyroVariance > 0)
+  {
+    const double s = qTT + gyroVariance;
+    const double kS = qST / s, kT = qTT / s;
+    gyroInnovation_ = gyroDtheta - dtheta;
+
+    ds += kS * gyroInnovation_;
+    dtheta += kT * gyroInnovation_;
+
+    qSS -= kS * qST;
+    qST *= gyroVariance / s;
+    qTT *= gyroVariance / s;
+  }
+
+  //Follow the arc exactly; for a nearly straight step its chord at the mid heading is the same
+  const double thetaMid = theta_ + dtheta / 2;
+  const double chord = std::fabs(dtheta) > 1e-9 ? ds * std::sin(dtheta / 2) / (dtheta / 2) : ds;
+  const double cosMid = std::cos(thetaMid), sinMid = std::sin(thetaMid);
+
+  x_ += chord * cosMid;
+  y_ += chord * sinMid;
+  theta_ = std::remainder(theta_ + dtheta, 2 * M_PI);
+
+  //P = F P F' + G Q G' with F = d(pose')/d(pose) and G = d(pose')/d(ds, dtheta), linearized at the mid heading
+  const double f02 = -chord * sinMid, f12 = chord * cosMid;
+  const double g00 = cosMid, g01 = -chord / 2 * sinMid,
+               g10 = sinMid, g11 = chord / 2 * cosMid;
+
+  const poseCovariance &p = poseCov_;
+
+  //F P F', F is identity plus the heading column
+  const double pxx = p[0] + 2 * f02 * p[2] + f02 * f02 * p[8],
+               pxy = p[1] + f02 * p[5] + f12 * p[2] + f02 * f12 * p[8],
+               pxt = p[2] + f02 * p[8],
+               pyy = p[4] + 2 * f12 * p[5] + f12 * f12 * p[8],
+               pyt = p[5] + f12 * p[8],
+               ptt = p[8];
+
+  //G Q G', the heading row of G is (0, 1)
+  const double gq00 = g00 * qSS + g01 * qST, gq01 = g00 * qST + g01 * qTT,
+               gq10 = g10 * qSS + g11 * qST, gq11 = g10 * qST + g11 * qTT;
+
+  poseCov_[0] = pxx + gq00 * g00 + gq01 * g01;
+  poseCov_[1] = poseCov_[3] = pxy + gq00 * g10 + gq01 * g11;
+  poseCov_[2] = poseCov_[6] = pxt + gq01;
+  poseCov_[4] = pyy + gq10 * g10 + gq11 * g11;
+  poseCov_[5] = poseCov_[7] = pyt + gq11;
+  poseCov_[8] = ptt + qTT;
+
+  if (dt > 0)
+  {
+    v_ = ds / dt;
+    omega_ = dtheta / dt;
+
+    twistCov_[0] = qSS / (dt * dt);
+    twistCov_[1] = twistCov_[2] = qST / (dt * dt);
+    twistCov_[3] = qTT / (dt * dt);
+  }
+
+  return true;
+}
+
+/**
+* Takes new counts without moving, for when the wheels turned but the robot didn't
+* @param leftCount  Cumulative left quad count
+* @param rightCount Cumulative right quad count
+*/
+void diffDriveOdometry::hold(const int32_t leftCount, const int32_t rightCount)
+{
+  primed_ = true;
+  lastLeft_ = leftCount;
+  lastRight_ = rightCount;
+  leftDelta_ = rightDelta_ = 0;
+
+  v_ = omega_ = 0;
+  twistCov_.fill(0);
+  twistCov_[0] = twistCov_[3] = 1e-9;
+}
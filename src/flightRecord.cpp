@@ -0,0 +1,338 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <vector>
+
+#include "robot_driver/flightRecord.h"
+
+namespace
+{
+  struct crcTable
+  {
+    uint32_t entries[256];
+
+    crcTable()
+    {
+      for (uint32_t i = 0; i < 256; i++)
+      {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+          crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        entries[i] = crc;
+      }
+    }
+  };
+
+  const crcTable table;
+
+  template <typename T>
+  void put(uint8_t **data, const T value)
+  {
+    std::memcpy(*data, &value, sizeof(T));
+    *data += sizeof(T);
+  }
+
+  template <typename T>
+  T get(const uint8_t **data)
+  {
+    T value;
+    std::memcpy(&value, *data, sizeof(T));
+    *data += sizeof(T);
+    return value;
+  }
+}
+
+/**
+* CRC-32 (IEEE) of some bytes
+* @param  data   Bytes
+* @param  length Number of bytes
+* @param  crc    CRC of the bytes before, to continue it
+* @return        CRC
+*/
+uint32_t crc32(const uint8_t *data, const size_t length, const uint32_t crc)
+{
+  uint32_t c = ~crc;
+  for (size_t i = 0; i < length; i++)
+    c = table.entries[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+  return ~c;
+}
+
+/**
+* Computes a record's CRC from its header fields and data. Padding only covers its header.
+*/
+uint32_t flightRecordCrc(const flightRecordHeader &header, const uint8_t *data)
+{
+  const uint8_t *fields = reinterpret_cast<const uint8_t*>(&header) + sizeof(header.crc);
+  const uint32_t crc = crc32(fields, sizeof(header) - sizeof(header.crc));
+  return header.type == flightPadding ? crc : crc32(data, header.length, crc);
+}
+
+/**
+* Finds where the complete records starting at a position end
+* @param  ring     Start of the ring
+* @param  capacity Ring size in bytes
+* @param  from     Position of the first record
+* @return          Position after the last complete record, from if there is none
+*/
+uint64_t scanFlightRecords(const uint8_t *ring, const uint64_t capacity, const uint64_t from)
+{
+  uint64_t position = from;
+
+  while (position - from < capacity)
+  {
+    const uint64_t offset = position % capacity, room = capacity - offset;
+
+    //Too close to the end for a header, the writer went straight to the start
+    if (room < sizeof(flightRecordHeader))
+    {
+      position += room;
+      continue;
+    }
+
+    flightRecordHeader header;
+    std::memcpy(&header, ring + offset, sizeof(header));
+
+    const size_t size = flightRecordSize(header.length);
+    if (header.position != position || size > room || position + size - from > capacity ||
+        header.crc != flightRecordCrc(header, ring + offset + sizeof(header)))
+      break;
+
+    position += size;
+  }
+
+  return position;
+}
+
+/**
+* Packs an IMU burst into a flightImu record's data
+* @param sample IMU sample
+* @param data   Filled with flightImuRecordLength bytes
+*/
+void encodeImuRecord(const mpu6000_sample &sample, uint8_t *data)
+{
+  for (int i = 0; i < 3; i++)
+    put(&data, sample.raw_acc[i]);
+  put(&data, sample.raw_temp);
+  for (int i = 0; i < 3; i++)
+    put(&data, sample.raw_rot[i]);
+
+  for (int i = 0; i < 3; i++)
+    put(&data, sample.acc[i]);
+  put(&data, sample.temp);
+  for (int i = 0; i < 3; i++)
+    put(&data, sample.rot[i]);
+}
+
+/**
+* Unpacks a flightImu record
+* @param  record Record
+* @param  sample Filled with the IMU sample
+* @return        False if the record isn't an IMU sample
+*/
+bool decodeImuRecord(const flightRecordView &record, mpu6000_sample *sample)
+{
+  if (record.type != flightImu || record.length != flightImuRecordLength)
+    return false;
+
+  const uint8_t *data = record.data;
+  for (int i = 0; i < 3; i++)
+    sample->raw_acc[i] = get<int16_t>(&data);
+  sample->raw_temp = get<int16_t>(&data);
+  for (int i = 0; i < 3; i++)
+    sample->raw_rot[i] = get<int16_t>(&data);
+
+  for (int i = 0; i < 3; i++)
+    sample->acc[i] = get<float>(&data);
+  sample->temp = get<float>(&data);
+  for (int i = 0; i < 3; i++)
+    sample->rot[i] = get<float>(&data);
+
+  return true;
+}
+
+/**
+* Packs an IMU bias model into a flightImuBias record's data
+* @param model Bias model
+* @param data  Filled with flightImuBiasRecordLength bytes
+*/
+void encodeImuBiasRecord(const imuBiasModel &model, uint8_t *data)
+{
+  for (int i = 0; i < 3; i++)
+    put(&data, model.offset.acc[i]);
+  for (int i = 0; i < 3; i++)
+    put(&data, model.offset.rot[i]);
+  for (int i = 0; i < 3; i++)
+    put(&data, model.slope.acc[i]);
+  for (int i = 0; i < 3; i++)
+    put(&data, model.slope.rot[i]);
+
+  put(&data, model.referenceTemperature);
+  put(&data, model.minTemperature);
+  put(&data, model.maxTemperature);
+  put(&data, uint8_t(model.hasTemperature ? 1 : 0));
+}
+
+/**
+* Unpacks a flightImuBias record
+* @param  record Record
+* @param  model  Filled with the bias model
+* @return        False if the record isn't a bias model
+*/
+bool decodeImuBiasRecord(const flightRecordView &record, imuBiasModel *model)
+{
+  if (record.type != flightImuBias || record.length != flightImuBiasRecordLength)
+    return false;
+
+  const uint8_t *data = record.data;
+  for (int i = 0; i < 3; i++)
+    model->offset.acc[i] = get<double>(&data);
+  for (int i = 0; i < 3; i++)
+    model->offset.rot[i] = get<double>(&data);
+  for (int i = 0; i < 3; i++)
+    model->slope.acc[i] = get<double>(&data);
+  for (int i = 0; i < 3; i++)
+    model->slope.rot[i] = get<double>(&data);
+
+  model->referenceTemperature = get<double>(&data);
+  model->minTemperature = get<double>(&data);
+  model->maxTemperature = get<double>(&data);
+  model->hasTemperature = get<uint8_t>(&data) != 0;
+
+  return true;
+}
+
+/**
+* Maps a file and finds its records
+* @param  path File to read
+* @return      False if the file can't be read or isn't a flight record
+*/
+bool flightRecordReader::open(const std::string &path)
+{
+  close();
+
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd_, &info) != 0 || size_t(info.st_size) < flightDataOffset)
+  {
+    close();
+    return false;
+  }
+
+  mapSize_ = info.st_size;
+  void *map = mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED)
+  {
+    map_ = nullptr;
+    close();
+    return false;
+  }
+  map_ = static_cast<const uint8_t*>(map);
+
+  flightFileHeader header;
+  std::memcpy(&header, map_, sizeof(header));
+  if (std::memcmp(header.magic, flightFileMagic, sizeof(flightFileMagic)) != 0 || header.version != flightFileVersion ||
+      header.dataOffset < sizeof(header) || header.capacity == 0 || header.dataOffset + header.capacity > mapSize_ ||
+      header.tail > header.head || header.head - header.tail > header.capacity)
+  {
+    close();
+    return false;
+  }
+
+  ring_ = map_ + header.dataOffset;
+  capacity_ = header.capacity;
+  tail_ = cursor_ = header.tail;
+  end_ = stop_ = scanFlightRecords(ring_, capacity_, tail_);
+  return true;
+}
+
+void flightRecordReader::close()
+{
+  if (map_ != nullptr)
+    munmap(const_cast<uint8_t*>(map_), mapSize_);
+  if (fd_ >= 0)
+    ::close(fd_);
+
+  fd_ = -1;
+  map_ = ring_ = nullptr;
+  mapSize_ = 0;
+  capacity_ = tail_ = end_ = cursor_ = stop_ = 0;
+}
+
+/**
+* Returns the next record, skipping padding. Its data stays valid until the reader is closed.
+* @param  record Filled with the record
+* @return        False after the newest record
+*/
+bool flightRecordReader::next(flightRecordView *record)
+{
+  while (cursor_ < stop_)
+  {
+    const uint64_t offset = cursor_ % capacity_, room = capacity_ - offset;
+    if (room < sizeof(flightRecordHeader))
+    {
+      cursor_ += room;
+      continue;
+    }
+
+    //On a file still being recorded the writer may have lapped the reader
+    flightRecordHeader header;
+    std::memcpy(&header, ring_ + offset, sizeof(header));
+    if (header.position != cursor_ || flightRecordSize(header.length) > room ||
+        header.crc != flightRecordCrc(header, ring_ + offset + sizeof(header)))
+    {
+      end_ = stop_ = cursor_;
+      return false;
+    }
+    cursor_ += flightRecordSize(header.length);
+
+    if (header.type == flightPadding)
+      continue;
+
+    record->type = static_cast<flightRecordType>(header.type);
+    record->flags = header.flags;
+    record->length = header.length;
+    record->position = header.position;
+    record->monotonicNs = header.monotonicNs;
+    record->rosNs = header.rosNs;
+    record->data = ring_ + offset + sizeof(header);
+    return true;
+  }
+
+  return false;
+}
+
+/**
+* Limits the reader to one session: from its flightSessionStart record up to the next one
+* @param  index Session counted from the oldest one whose start is still in the file, or from the
+*               newest when negative, -1 being the newest
+* @return       False if there is no such session, the reader then reads every session
+*/
+bool flightRecordReader::selectSession(const int index)
+{
+  rewind();
+
+  std::vector<uint64_t> starts;
+  flightRecordView record;
+  while (next(&record))
+  {
+    if (record.type == flightSessionStart)
+      starts.push_back(record.position);
+  }
+
+  rewind();
+
+  const int count = starts.size(), session = index < 0 ? count + index : index;
+  if (session < 0 || session >= count)
+    return false;
+
+  cursor_ = starts[session];
+  if (session + 1 < count)
+    stop_ = starts[session + 1];
+  return true;
+}
@@ -0,0 +1,303 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "robot_driver/flightRecorder.h"
+
+//Storage for the constants std::min and std::chrono::duration take by reference
+const size_t flightRecorder::maxSerialChunk;
+constexpr double flightRecorder::writePeriod, flightRecorder::syncPeriod;
+
+/**
+* Creates or reopens the ring file and starts the writing thread
+* @param  path File to record to
+* @param  size File size in bytes. A file of another size is started over.
+* @return      False if the file can't be created or mapped
+*/
+bool flightRecorder::open(const std::string &path, const size_t size)
+{
+  close();
+
+  const size_t capacity = (size > flightDataOffset ? size - flightDataOffset : 0) & ~(flightRecordAlignment - 1);
+  if (capacity < flightRecordSize(maxRecordLength) * 2)
+    return false;
+
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    return false;
+
+  //Allocate every block up front so a full disk can't fault the mapping later
+  struct stat info;
+  mapSize_ = flightDataOffset + capacity;
+  if (fstat(fd_, &info) != 0 || (size_t(info.st_size) != mapSize_ &&
+      (ftruncate(fd_, 0) != 0 || posix_fallocate(fd_, 0, mapSize_) != 0)))
+  {
+    close();
+    return false;
+  }
+
+  void *map = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+  map_ = static_cast<uint8_t*>(map);
+  header_ = reinterpret_cast<flightFileHeader*>(map_);
+  ring_ = map_ + flightDataOffset;
+  capacity_ = capacity;
+
+  //Carry on after the last session's records, including any it wrote after its last header update
+  if (std::memcmp(header_->magic, flightFileMagic, sizeof(flightFileMagic)) == 0 && header_->version == flightFileVersion &&
+      header_->dataOffset == flightDataOffset && header_->capacity == capacity_ &&
+      header_->tail <= header_->head && header_->head - header_->tail <= capacity_)
+  {
+    tail_ = header_->tail;
+    head_ = scanFlightRecords(ring_, capacity_, tail_);
+  }
+  else
+  {
+    std::memset(header_, 0, flightDataOffset);
+    std::memcpy(header_->magic, flightFileMagic, sizeof(flightFileMagic));
+    header_->version = flightFileVersion;
+    header_->dataOffset = flightDataOffset;
+    header_->capacity = capacity_;
+    tail_ = head_ = 0;
+  }
+  storeHeader();
+
+  append(flightSessionStart, 0, nullptr, 0, steadyNs(), 0);
+
+  running_ = true;
+  thread_ = std::thread(&flightRecorder::run, this);
+  return true;
+}
+
+/**
+* Writes what is queued, stops the writing thread and syncs the file
+*/
+void flightRecorder::close()
+{
+  if (thread_.joinable())
+  {
+    running_ = false;
+    thread_.join();
+  }
+
+  if (map_ != nullptr)
+  {
+    msync(map_, mapSize_, MS_SYNC);
+    munmap(map_, mapSize_);
+  }
+  if (fd_ >= 0)
+    ::close(fd_);
+
+  fd_ = -1;
+  map_ = ring_ = nullptr;
+  header_ = nullptr;
+  mapSize_ = 0;
+}
+
+/**
+* Queues bytes read from the cortex
+* @param data        Bytes read
+* @param length      Number of bytes
+* @param monotonicNs Arrival time on the steady clock in nanoseconds
+* @param rosNs       Arrival time in ROS time in nanoseconds
+*/
+void flightRecorder::recordSerial(const uint8_t *data, const size_t length, const int64_t monotonicNs, const int64_t rosNs)
+{
+  if (!running_.load(std::memory_order_relaxed))
+    return;
+
+  entry item;
+  item.type = flightSerial;
+  item.monotonicNs = monotonicNs;
+  item.rosNs = rosNs;
+
+  for (size_t offset = 0; offset < length; offset += maxSerialChunk)
+  {
+    item.length = std::min(maxSerialChunk, length - offset);
+    item.flags = offset + item.length < length ? flightSerialContinued : 0;
+    std::memcpy(item.data, data + offset, item.length);
+    enqueue(&serialQueue_, item);
+  }
+}
+
+/**
+* Queues an IMU burst
+* @param sample      IMU sample
+* @param monotonicNs Measurement time on the steady clock in nanoseconds
+* @param rosNs       Measurement time in ROS time in nanoseconds
+*/
+void flightRecorder::recordImu(const mpu6000_sample &sample, const int64_t monotonicNs, const int64_t rosNs)
+{
+  if (!running_.load(std::memory_order_relaxed))
+    return;
+
+  entry item;
+  item.type = flightImu;
+  item.flags = 0;
+  item.length = flightImuRecordLength;
+  item.monotonicNs = monotonicNs;
+  item.rosNs = rosNs;
+  encodeImuRecord(sample, item.data);
+  enqueue(&imuQueue_, item);
+}
+
+/**
+* Queues the IMU bias model the next bursts start from
+* @param model       Bias model
+* @param monotonicNs Time on the steady clock in nanoseconds
+* @param rosNs       Time in ROS time in nanoseconds
+*/
+void flightRecorder::recordImuBias(const imuBiasModel &model, const int64_t monotonicNs, const int64_t rosNs)
+{
+  if (!running_.load(std::memory_order_relaxed))
+    return;
+
+  entry item;
+  item.type = flightImuBias;
+  item.flags = 0;
+  item.length = flightImuBiasRecordLength;
+  item.monotonicNs = monotonicNs;
+  item.rosNs = rosNs;
+  encodeImuBiasRecord(model, item.data);
+  enqueue(&imuQueue_, item);
+}
+
+/**
+* Queues an entry, counting it as dropped if the queue is full
+*/
+void flightRecorder::enqueue(entryQueue *queue, const entry &item)
+{
+  if (!queue->push(item))
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* Writing thread main loop
+*/
+void flightRecorder::run()
+{
+  std::chrono::steady_clock::time_point nextSync = std::chrono::steady_clock::now();
+
+  while (running_)
+  {
+    drain();
+
+    //Ask the kernel to start writing back now and then, so a power cut loses at most a moment
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now >= nextSync)
+    {
+      msync(map_, mapSize_, MS_ASYNC);
+      nextSync = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(syncPeriod));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(writePeriod));
+  }
+
+  drain();
+}
+
+/**
+* Writes every queued entry, oldest first
+*/
+void flightRecorder::drain()
+{
+  entry serial, imu;
+  bool haveSerial = serialQueue_.pop(&serial), haveImu = imuQueue_.pop(&imu);
+
+  while (haveSerial || haveImu)
+  {
+    const bool takeSerial = haveSerial && (!haveImu || serial.monotonicNs <= imu.monotonicNs);
+    const entry &item = takeSerial ? serial : imu;
+
+    append(item.type, item.flags, item.data, item.length, item.monotonicNs, item.rosNs);
+
+    if (takeSerial)
+      haveSerial = serialQueue_.pop(&serial);
+    else
+      haveImu = imuQueue_.pop(&imu);
+  }
+
+  storeHeader();
+}
+
+/**
+* Appends one record to the ring, overwriting the oldest ones to make room
+*/
+void flightRecorder::append(const uint8_t type, const uint8_t flags, const uint8_t *data, const uint16_t length,
+                            const int64_t monotonicNs, const int64_t rosNs)
+{
+  const size_t size = flightRecordSize(length);
+  uint64_t room = capacity_ - head_ % capacity_;
+
+  //Records don't wrap, fill the end of the ring instead
+  if (room < size)
+  {
+    release(head_ + room);
+    if (room >= sizeof(flightRecordHeader))
+      append(flightPadding, 0, nullptr, room - sizeof(flightRecordHeader), monotonicNs, rosNs);
+    else
+      head_ += room;
+  }
+
+  release(head_ + size);
+
+  flightRecordHeader header;
+  header.type = type;
+  header.flags = flags;
+  header.length = length;
+  header.position = head_;
+  header.monotonicNs = monotonicNs;
+  header.rosNs = rosNs;
+  header.crc = flightRecordCrc(header, data);
+
+  uint8_t *record = ring_ + head_ % capacity_;
+  std::memcpy(record, &header, sizeof(header));
+  if (length > 0 && type != flightPadding)
+    std::memcpy(record + sizeof(header), data, length);
+
+  head_ += size;
+  written_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* Moves tail past every record that overlaps the bytes up to a position
+*/
+void flightRecorder::release(const uint64_t end)
+{
+  bool moved = false;
+  while (end - tail_ > capacity_)
+  {
+    const uint64_t offset = tail_ % capacity_, room = capacity_ - offset;
+    if (room < sizeof(flightRecordHeader))
+    {
+      tail_ += room;
+    }
+    else
+    {
+      flightRecordHeader header;
+      std::memcpy(&header, ring_ + offset, sizeof(header));
+      tail_ += flightRecordSize(header.length);
+    }
+    moved = true;
+  }
+
+  //The header must stop pointing at a record before it is overwritten
+  if (moved)
+    storeHeader();
+}
+
+void flightRecorder::storeHeader()
+{
+  std::atomic_thread_fence(std::memory_order_release);
+  __atomic_store_n(&header_->tail, tail_, __ATOMIC_RELEASE);
+  __atomic_store_n(&header_->head, head_, __ATOMIC_RELEASE);
+}
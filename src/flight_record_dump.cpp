@@ -0,0 +1,101 @@
+/**
+ * Prints the records of a flight record file robot_driver writes when ~flight_record is set,
+ * oldest first, one line each: "monotonic_sec ros_sec type details". Serial records show their
+ * bytes in hex, IMU records the scaled accel in Gs, temperature in °C and gyro in Degrees per
+ * second, bias records the offsets and slopes the IMU started from.
+ *
+ * Usage: flight_record_dump [-s] flight.rec
+ *
+ *   -s  Only print how many records of each type there are and the time they span
+ */
+
+#include <unistd.h>
+
+#include <cstdio>
+
+#include "robot_driver/flightRecord.h"
+
+int main(int argc, char **argv)
+{
+  bool summary = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s")) != -1)
+  {
+    if (opt != 's')
+    {
+      std::fprintf(stderr, "usage: flight_record_dump [-s] flight.rec\n");
+      return 1;
+    }
+    summary = true;
+  }
+
+  if (optind + 1 != argc)
+  {
+    std::fprintf(stderr, "usage: flight_record_dump [-s] flight.rec\n");
+    return 1;
+  }
+
+  flightRecordReader reader;
+  if (!reader.open(argv[optind]))
+  {
+    std::fprintf(stderr, "flight_record_dump: %s isn't a flight record\n", argv[optind]);
+    return 1;
+  }
+
+  static const char *typeNames[] = {"padding", "session", "serial", "imu", "bias"};
+  static const int typeCount = sizeof(typeNames) / sizeof(typeNames[0]);
+  unsigned long counts[typeCount] = {0, 0, 0, 0, 0}, serialBytes = 0;
+  int64_t firstRos = 0, lastRos = 0;
+
+  flightRecordView record;
+  while (reader.next(&record))
+  {
+    const int type = record.type < typeCount ? record.type : 0;
+    counts[type]++;
+
+    if (record.rosNs != 0)
+    {
+      if (firstRos == 0)
+        firstRos = record.rosNs;
+      lastRos = record.rosNs;
+    }
+
+    if (record.type == flightSerial)
+      serialBytes += record.length;
+
+    if (summary)
+      continue;
+
+    std::printf("%.6f %.6f %s", record.monotonicNs / 1e9, record.rosNs / 1e9, typeNames[type]);
+
+    mpu6000_sample sample;
+    imuBiasModel bias;
+    if (record.type == flightSerial)
+    {
+      for (int i = 0; i < record.length; i++)
+        std::printf(" %02x", record.data[i]);
+      if (record.flags & flightSerialContinued)
+        std::printf(" ...");
+    }
+    else if (decodeImuRecord(record, &sample))
+    {
+      std::printf(" acc %.4f %.4f %.4f temp %.2f rot %.3f %.3f %.3f", sample.acc[0], sample.acc[1], sample.acc[2],
+                  sample.temp, sample.rot[0], sample.rot[1], sample.rot[2]);
+    }
+    else if (decodeImuBiasRecord(record, &bias))
+    {
+      std::printf(" acc %.4f %.4f %.4f rot %.3f %.3f %.3f", bias.offset.acc[0], bias.offset.acc[1], bias.offset.acc[2],
+                  bias.offset.rot[0], bias.offset.rot[1], bias.offset.rot[2]);
+      if (bias.hasTemperature)
+        std::printf(" at %.2f, rot %.4f %.4f %.4f per C", bias.referenceTemperature, bias.slope.rot[0], bias.slope.rot[1],
+                    bias.slope.rot[2]);
+    }
+    std::printf("\n");
+  }
+
+  std::printf("%lu sessions, %lu serial records (%lu bytes), %lu imu samples over %.1f s, %llu of %llu bytes used\n",
+              counts[flightSessionStart], counts[flightSerial], serialBytes, counts[flightImu], (lastRos - firstRos) / 1e9,
+              (unsigned long long)reader.getRecordedBytes(), (unsigned long long)reader.getCapacity());
+  return 0;
+}
@@ -0,0 +1,29 @@
+#include <cstdio>
+
+#include "robot_driver/frameLog.h"
+
+/**
+* Reads a log of "arrival_sec,dt_ms,left,right" lines
+* @param  path File to read
+* @param  log  Filled with the frames
+* @return      False if the file couldn't be opened
+*/
+bool readFrameLog(const std::string &path, frameLog *log)
+{
+  FILE *in = std::fopen(path.c_str(), "r");
+  if (in == nullptr)
+    return false;
+
+  double arrival, dtMs;
+  int32_t left, right;
+  while (std::fscanf(in, "%lf,%lf,%d,%d", &arrival, &dtMs, &left, &right) == 4)
+  {
+    log->arrival.push_back(arrival);
+    log->dt.push_back(dtMs / 1000);
+    log->left.push_back(left);
+    log->right.push_back(right);
+  }
+
+  std::fclose(in);
+  return true;
+}
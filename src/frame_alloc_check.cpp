@@ -0,0 +1,204 @@
+/**
+ * Checks that handling a cortex std frame doesn't touch the heap once warmed up.
+ *
+ * Usage: frame_alloc_check
+ *
+ * Frames are built and fed in chunks like serial reads through cortexReceiver, the same code
+ * robotPOS::poll and handleFrame run: parsing, sequence counting, latency marks, stamping and
+ * integrating with the IMU samples pre-integrated between them through an imuFeed. This runs
+ * first to warm up and then with every operator new and malloc counted. Exits with 1 if anything
+ * was allocated or a frame went missing. What robotPOS adds needs ROS and isn't part of this
+ * check: filling the odometry message, whose arrays are fixed size, and the message itself, which
+ * is allocated on purpose because each subscriber keeps its own.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "robot_driver/cortexReceiver.h"
+#include "robot_driver/imuFeed.h"
+#include "robot_driver/latencyMonitor.h"
+
+static std::atomic<bool> counting{false};
+static std::atomic<unsigned long> allocations{0};
+
+//glibc's own allocator, so malloc itself can be counted
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void __libc_free(void *pointer);
+
+extern "C" void *malloc(size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+  if (counting)
+    allocations++;
+  return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void *pointer)
+{
+  __libc_free(pointer);
+}
+
+void *operator new(size_t size)
+{
+  if (counting)
+    allocations++;
+  if (void *pointer = __libc_malloc(size ? size : 1))
+    return pointer;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+  __libc_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+  __libc_free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+  __libc_free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+  __libc_free(pointer);
+}
+
+//Std frame as the cortex sends it: a byte robotPOS ignores, left and right quads, dt in ms
+static const uint8_t stdType = 1, stdLength = 10;
+
+/**
+ * Feeds frames and IMU samples to the code robotPOS runs on them
+ */
+struct frameHandler
+{
+  imuFeed imu;
+  latencyMonitor latency;
+  cortexReceiver receiver;
+
+  int32_t left = 0, right = 0;
+  uint8_t count = 0;
+  double arrival = 0;
+  unsigned long frames = 0;
+
+  frameHandler(): receiver(diffDriveGeometry(), imu, latency)
+  {
+    receiver.setPayloadLength(stdType, stdLength);
+    receiver.setVersion(2);
+
+    //A bias that leaves gravity on Z, so the robot isn't tipped
+    imuBiasModel bias;
+    bias.offset.acc[2] = 1;
+    imu.setBias(bias);
+  }
+
+  /**
+   * Sends one frame's worth of IMU samples and the frame, in chunks like serial reads
+   */
+  void step()
+  {
+    mpu6000_sample sample = mpu6000_sample();
+    sample.acc[2] = 1;
+    sample.rot[2] = 5;
+    for (int i = 0; i < 7; i++)
+      imu.add(arrival + i * 0.002, sample, imu.getBias(sample.temp));
+
+    left += 10;
+    right += 12;
+    uint8_t payload[stdLength] = {0};
+    std::memcpy(&payload[1], &left, 4);
+    std::memcpy(&payload[5], &right, 4);
+    payload[9] = 15;
+
+    uint8_t bytes[cortexFrameParser::maxFrameLength];
+    const size_t length = buildCortexFrame(stdType, count++, payload, stdLength, 2, bytes);
+
+    //Parsed the way robotPOS::poll parses each serial read, five bytes per read here
+    arrival += 0.015;
+    for (size_t offset = 0; offset < length;)
+    {
+      const size_t end = std::min<size_t>(offset + 5, length);
+      const monotonicClock::time_point readTime = monotonicClock::now();
+      while (offset < end)
+      {
+        const cortexFrame *frame;
+        offset += receiver.parse(&bytes[offset], end - offset, readTime, &frame);
+        if (frame != nullptr && frame->type == stdType)
+          handle(*frame);
+      }
+    }
+  }
+
+  /**
+   * Integrates a std frame and takes its IMU window the way robotPOS::handleFrame and
+   * popFrameImu do
+   */
+  void handle(const cortexFrame &frame)
+  {
+    cortexStdFrame values;
+    receiver.handleStd(frame, arrival, &values);
+
+    imuPreintegration window;
+    receiver.takeFrameImu(&window);
+    frames++;
+  }
+};
+
+int main()
+{
+  constexpr int warmup = 1000, checked = 100000;
+  frameHandler handler;
+
+  for (int i = 0; i < warmup; i++)
+    handler.step();
+
+  counting = true;
+  for (int i = 0; i < checked; i++)
+    handler.step();
+  counting = false;
+
+  std::printf("%lu frames handled, %lu allocations in the last %d (x %.3f to keep the loop alive)\n",
+              handler.frames, allocations.load(), checked, handler.receiver.odometry().x());
+
+  if (handler.frames != warmup + checked || handler.receiver.getMissedFrames() > 0)
+  {
+    std::printf("FAILED: expected %d frames, %lu went missing\n", warmup + checked, handler.receiver.getMissedFrames());
+    return 1;
+  }
+
+  if (allocations > 0)
+  {
+    std::printf("FAILED: frame handling allocated\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <boost/system/system_error.hpp>
+
+#include "robot_driver/gpioEventSource.h"
+
+namespace
+{
+  //Waits for an fd to become readable
+  //false on timeout
+  bool waitReadable(const int fd, const int timeoutMs, const char *what)
+  {
+    pollfd pfd = {fd, POLLIN, 0};
+    const int result = poll(&pfd, 1, timeoutMs);
+
+    if (result < 0 && errno != EINTR)
+      throw boost::system::system_error(errno, boost::system::system_category(), what);
+
+    return result > 0;
+  }
+}
+
+gpioChardevEvents::gpioChardevEvents(const std::string &chip, const int line)
+{
+  const int chipFd = open(chip.c_str(), O_RDONLY | O_CLOEXEC);
+  if (chipFd < 0)
+    throw boost::system::system_error(errno, boost::system::system_category(), "gpioChardevEvents: can't open " + chip);
+
+  gpioevent_request request;
+  std::memset(&request, 0, sizeof(request));
+  request.lineoffset = line;
+  request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  request.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+  std::strncpy(request.consumer_label, "robot_driver imu", sizeof(request.consumer_label) - 1);
+
+  //The line event fd stays valid once the chip is closed
+  const int result = ioctl(chipFd, GPIO_GET_LINEEVENT_IOCTL, &request);
+  const int error = errno;
+  close(chipFd);
+
+  if (result < 0)
+    throw boost::system::system_error(error, boost::system::system_category(),
+                                      "gpioChardevEvents: can't watch line " + std::to_string(line) + " of " + chip);
+
+  fd_ = request.fd;
+}
+
+gpioChardevEvents::~gpioChardevEvents()
+{
+  close(fd_);
+}
+
+/**
+* Blocks until the line has risen or the timeout passed
+* @param  timeoutMs Longest wait in milliseconds
+* @return           Edges since the last call, 0 on timeout
+*/
+int gpioChardevEvents::wait(const int timeoutMs)
+{
+  if (!waitReadable(fd_, timeoutMs, "gpioChardevEvents: poll failed"))
+    return 0;
+
+  //The kernel queues every edge, take all of them so one late wakeup isn't followed by a burst
+  gpioevent_data events[16];
+  const ssize_t length = read(fd_, events, sizeof(events));
+  if (length < 0)
+  {
+    if (errno == EINTR || errno == EAGAIN)
+      return 0;
+    throw boost::system::system_error(errno, boost::system::system_category(), "gpioChardevEvents: read failed");
+  }
+
+  return length / sizeof(gpioevent_data);
+}
+
+gpioSimEvents::gpioSimEvents(const double period)
+{
+  fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (fd_ < 0)
+    throw boost::system::system_error(errno, boost::system::system_category(), "gpioSimEvents: can't create timer");
+
+  const int64_t periodNs = std::llround(period * 1e9);
+  itimerspec spec;
+  spec.it_interval.tv_sec = periodNs / 1000000000;
+  spec.it_interval.tv_nsec = periodNs % 1000000000;
+  spec.it_value = spec.it_interval;
+
+  if (timerfd_settime(fd_, 0, &spec, nullptr) < 0)
+  {
+    const int error = errno;
+    close(fd_);
+    throw boost::system::system_error(error, boost::system::system_category(), "gpioSimEvents: can't start timer");
+  }
+}
+
+gpioSimEvents::~gpioSimEvents()
+{
+  close(fd_);
+}
+
+/**
+* Blocks until the next simulated edge or the timeout passed
+* @param  timeoutMs Longest wait in milliseconds
+* @return           Edges since the last call, 0 on timeout
+*/
+int gpioSimEvents::wait(const int timeoutMs)
+{
+  if (!waitReadable(fd_, timeoutMs, "gpioSimEvents: poll failed"))
+    return 0;
+
+  uint64_t expirations = 0;
+  if (read(fd_, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return 0;
+
+  return expirations;
+}
+
+/**
+* Creates a data ready event source
+* @param  chip   GPIO chip device, or "sim" for edges at the sample period
+* @param  line   Line offset on the chip
+* @param  period Sample period in seconds, for "sim"
+* @return        The event source
+*/
+std::unique_ptr<gpioEventSource> createGpioEventSource(const std::string &chip, const int line, const double period)
+{
+  if (chip == "sim")
+    return std::unique_ptr<gpioEventSource>(new gpioSimEvents(period));
+
+  return std::unique_ptr<gpioEventSource>(new gpioChardevEvents(chip, line));
+}
@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "robot_driver/imuCalibration.h"
+
+//Axes of a bias in imuStatistics order: accel x, y, z, gyro x, y, z
+static double &axisOf(imuBias &bias, const int axis)
+{
+  return axis < 3 ? bias.acc[axis] : bias.rot[axis - 3];
+}
+
+static double axisOf(const imuBias &bias, const int axis)
+{
+  return axis < 3 ? bias.acc[axis] : bias.rot[axis - 3];
+}
+
+/**
+* Returns the bias at a die temperature
+* @param  temperature Die temperature in °C, from the same burst as the sample
+* @return             Bias
+*/
+imuBias imuBiasModel::at(const double temperature) const
+{
+  const double t = hasTemperature ? temperature - referenceTemperature : 0;
+  imuBias bias;
+
+  for (int axis = 0; axis < 3; axis++)
+  {
+    bias.acc[axis] = offset.acc[axis] + slope.acc[axis] * t;
+    bias.rot[axis] = offset.rot[axis] + slope.rot[axis] * t;
+  }
+
+  return bias;
+}
+
+/**
+* Whether the model can be trusted at a die temperature
+* @param  temperature Die temperature in °C
+* @param  margin      How far outside the seen temperatures to trust the model in °C
+* @return             True if close enough to the temperatures the model has seen
+*/
+bool imuBiasModel::covers(const double temperature, const double margin) const
+{
+  return !hasTemperature || (temperature > minTemperature - margin && temperature < maxTemperature + margin);
+}
+
+/**
+* Reads three comma separated values in brackets following a key
+* @return True if the line has the key and three values
+*/
+static bool readTriple(const std::string &line, const char *key, double *values)
+{
+  const size_t keyLength = std::strlen(key);
+  return line.compare(0, keyLength, key) == 0 &&
+         std::sscanf(line.c_str() + keyLength, " [%lf, %lf, %lf]", &values[0], &values[1], &values[2]) == 3;
+}
+
+/**
+* Reads a calibration saved by saveImuCalibration
+* @param  path        Calibration file
+* @param  calibration Filled with the calibration
+* @return             False if the file is missing or has no bias. Temperatures, slopes and chip
+*                     state are optional.
+*/
+bool loadImuCalibration(const std::string &path, imuCalibration *calibration)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+    return false;
+
+  imuCalibration loaded;
+  imuBiasModel &model = loaded.bias;
+  bool haveAcc = false, haveRot = false, haveRange = false, haveWhoami = false, haveRegisters = false, haveScale = false;
+  std::string line;
+
+  while (std::getline(in, line))
+  {
+    unsigned int registers[5];
+
+    if (readTriple(line, "acc_bias:", model.offset.acc))
+      haveAcc = true;
+    else if (readTriple(line, "rot_bias:", model.offset.rot))
+      haveRot = true;
+    else if (readTriple(line, "acc_slope:", model.slope.acc) || readTriple(line, "rot_slope:", model.slope.rot))
+      continue;
+    else if (std::sscanf(line.c_str(), "temperature: %lf", &model.referenceTemperature) == 1)
+      model.hasTemperature = true;
+    else if (std::sscanf(line.c_str(), "temperature_range: [%lf, %lf]", &model.minTemperature, &model.maxTemperature) == 2)
+      haveRange = true;
+    else if (std::sscanf(line.c_str(), "whoami: %u", &loaded.whoami) == 1)
+      haveWhoami = true;
+    else if (std::sscanf(line.c_str(), "scale: [%f, %f]", &loaded.accDivider, &loaded.gyroDivider) == 2)
+      haveScale = true;
+    else if (std::sscanf(line.c_str(), "registers: [%u, %u, %u, %u, %u]",
+                         &registers[0], &registers[1], &registers[2], &registers[3], &registers[4]) == 5)
+    {
+      loaded.registers.smplrt_div = registers[0];
+      loaded.registers.config = registers[1];
+      loaded.registers.gyro_config = registers[2];
+      loaded.registers.accel_config = registers[3];
+      loaded.registers.pwr_mgmt_1 = registers[4];
+      haveRegisters = true;
+    }
+  }
+
+  if (!haveAcc || !haveRot)
+    return false;
+
+  //Files from before the model only know the temperature the bias was measured at
+  if (model.hasTemperature && !haveRange)
+    model.minTemperature = model.maxTemperature = model.referenceTemperature;
+
+  loaded.hasChipState = haveWhoami && haveRegisters && haveScale;
+  *calibration = loaded;
+  return true;
+}
+
+/**
+* Writes a calibration, replacing the file in one step so a crash never leaves half of it
+* @param  path        Calibration file
+* @param  calibration Calibration to save
+* @return             False if the file couldn't be written
+*/
+bool saveImuCalibration(const std::string &path, const imuCalibration &calibration)
+{
+  const std::string temporary = path + ".tmp";
+  FILE *out = std::fopen(temporary.c_str(), "w");
+  if (out == nullptr)
+    return false;
+
+  const imuBiasModel &model = calibration.bias;
+  std::fprintf(out, "# robot_driver IMU calibration, accel in g and gyro in deg/s\n");
+  std::fprintf(out, "# bias = *_bias + *_slope * (die temperature - temperature)\n");
+  std::fprintf(out, "acc_bias: [%.9g, %.9g, %.9g]\n", model.offset.acc[0], model.offset.acc[1], model.offset.acc[2]);
+  std::fprintf(out, "rot_bias: [%.9g, %.9g, %.9g]\n", model.offset.rot[0], model.offset.rot[1], model.offset.rot[2]);
+  std::fprintf(out, "acc_slope: [%.9g, %.9g, %.9g]\n", model.slope.acc[0], model.slope.acc[1], model.slope.acc[2]);
+  std::fprintf(out, "rot_slope: [%.9g, %.9g, %.9g]\n", model.slope.rot[0], model.slope.rot[1], model.slope.rot[2]);
+
+  if (model.hasTemperature)
+  {
+    std::fprintf(out, "temperature: %.3f\n", model.referenceTemperature);
+    std::fprintf(out, "temperature_range: [%.3f, %.3f]\n", model.minTemperature, model.maxTemperature);
+  }
+
+  if (calibration.hasChipState)
+  {
+    const mpu6000_config &registers = calibration.registers;
+    std::fprintf(out, "whoami: %u\n", calibration.whoami);
+    std::fprintf(out, "# smplrt_div, config, gyro_config, accel_config, pwr_mgmt_1\n");
+    std::fprintf(out, "registers: [%u, %u, %u, %u, %u]\n", registers.smplrt_div, registers.config,
+                 registers.gyro_config, registers.accel_config, registers.pwr_mgmt_1);
+    std::fprintf(out, "# LSB per g, LSB per deg/s\n");
+    std::fprintf(out, "scale: [%.9g, %.9g]\n", calibration.accDivider, calibration.gyroDivider);
+  }
+
+  const bool written = std::fflush(out) == 0 && !std::ferror(out);
+  std::fclose(out);
+
+  return written && std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/**
+* Adds a sample to every axis
+* @param sample IMU sample
+*/
+void imuStatistics::add(const mpu6000_sample &sample)
+{
+  const float *values[2] = {sample.acc, sample.rot};
+  count_++;
+
+  for (int axis = 0; axis < 7; axis++)
+  {
+    const double value = axis < 6 ? values[axis / 3][axis % 3] : sample.temp;
+    const double delta = value - mean_[axis];
+    mean_[axis] += delta / count_;
+    m2_[axis] += delta * (value - mean_[axis]);
+  }
+}
+
+/**
+* Forgets every sample
+*/
+void imuStatistics::reset()
+{
+  *this = imuStatistics();
+}
+
+/**
+* Means of every axis, accel in Gs and gyro in Degrees per second
+*/
+imuBias imuStatistics::mean() const
+{
+  imuBias bias;
+
+  for (int axis = 0; axis < 3; axis++)
+  {
+    bias.acc[axis] = mean_[axis];
+    bias.rot[axis] = mean_[axis + 3];
+  }
+
+  return bias;
+}
+
+/**
+* Largest standard deviation over the accel axes in Gs
+*/
+double imuStatistics::maxAccStdDev() const
+{
+  if (count_ < 2)
+    return 0;
+
+  return std::sqrt(std::max(m2_[0], std::max(m2_[1], m2_[2])) / (count_ - 1));
+}
+
+/**
+* Largest standard deviation over the gyro axes in Degrees per second
+*/
+double imuStatistics::maxRotStdDev() const
+{
+  if (count_ < 2)
+    return 0;
+
+  return std::sqrt(std::max(m2_[3], std::max(m2_[4], m2_[5])) / (count_ - 1));
+}
+
+imuBiasTracker::imuBiasTracker(const int windowLength, const double weight, const double forgetting):
+windowLength_(windowLength),
+weight_(weight),
+forgetting_(forgetting)
+{
+}
+
+/**
+* Forgets every sample and window, as if just constructed
+*/
+void imuBiasTracker::reset()
+{
+  window_.reset();
+  updates_ = 0;
+  sumWeight_ = sumT_ = sumTT_ = 0;
+  for (int i = 0; i < 6; i++)
+    sumBias_[i] = sumTBias_[i] = 0;
+}
+
+/**
+* Adds a sample
+* @param  sample IMU sample
+* @param  model  Bias model to refine
+* @return        True if model changed
+*/
+bool imuBiasTracker::add(const mpu6000_sample &sample, imuBiasModel *model)
+{
+  window_.add(sample);
+  if (window_.count() < windowLength_)
+    return false;
+
+  const imuBias mean = window_.mean();
+  const double temperature = window_.meanTemperature();
+  bool stationary = isStationary(window_);
+  window_.reset();
+
+  const imuBias predicted = model->at(temperature);
+  for (int axis = 0; axis < 3 && stationary; axis++)
+  {
+    stationary = std::fabs(mean.acc[axis] - predicted.acc[axis]) < maxAccChangeG &&
+                 std::fabs(mean.rot[axis] - predicted.rot[axis]) < maxRotChangeDps;
+  }
+
+  if (!stationary)
+    return false;
+
+  //A model without temperatures starts its reference here
+  if (!model->hasTemperature)
+  {
+    model->hasTemperature = true;
+    model->referenceTemperature = model->minTemperature = model->maxTemperature = temperature;
+  }
+
+  const double t = temperature - model->referenceTemperature;
+
+  sumWeight_ = forgetting_ * sumWeight_ + 1;
+  sumT_ = forgetting_ * sumT_ + t;
+  sumTT_ = forgetting_ * sumTT_ + t * t;
+
+  const double meanT = sumT_ / sumWeight_, varianceT = sumTT_ / sumWeight_ - meanT * meanT;
+  const bool refitSlope = varianceT > minSlopeSpread * minSlopeSpread;
+
+  for (int axis = 0; axis < 6; axis++)
+  {
+    const double bias = axisOf(mean, axis);
+
+    sumBias_[axis] = forgetting_ * sumBias_[axis] + bias;
+    sumTBias_[axis] = forgetting_ * sumTBias_[axis] + t * bias;
+
+    if (refitSlope)
+      axisOf(model->slope, axis) = (sumTBias_[axis] / sumWeight_ - meanT * sumBias_[axis] / sumWeight_) / varianceT;
+
+    double &offset = axisOf(model->offset, axis);
+    offset += weight_ * (bias - axisOf(model->slope, axis) * t - offset);
+  }
+
+  model->minTemperature = std::min(model->minTemperature, temperature);
+  model->maxTemperature = std::max(model->maxTemperature, temperature);
+
+  updates_++;
+  return true;
+}
+
+/**
+* Whether a window is quiet enough to be taken as the robot standing still
+* @param  statistics Statistics of the window
+* @return            True if stationary
+*/
+bool imuBiasTracker::isStationary(const imuStatistics &statistics)
+{
+  return statistics.maxAccStdDev() < stillAccStdDevG && statistics.maxRotStdDev() < stillRotStdDevDps;
+}
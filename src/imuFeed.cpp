@@ -0,0 +1,36 @@
+#include "robot_driver/imuFeed.h"
+
+namespace
+{
+  constexpr float dpsToRps = 0.01745;
+}
+
+/**
+* Makes a sample the latest and integrates it
+* @param stamp When it was measured in seconds
+* @param data  Raw sample
+* @param bias  Bias to remove before integrating it
+*/
+void imuFeed::add(const double stamp, const mpu6000_sample &data, const imuBias &bias)
+{
+  latest_.store(data);
+
+  double yawRate, acc[3];
+  toBaseLink(data, bias, &yawRate, acc);
+  preintegrator_.add(stamp, yawRate, acc);
+}
+
+/**
+* Removes the bias from a sample and rotates it into base_link
+* @param data    Raw sample
+* @param bias    Bias to remove
+* @param yawRate Filled with the yaw rate in rad/s
+* @param acc     Filled with the acceleration in m/s^2
+*/
+void imuFeed::toBaseLink(const mpu6000_sample &data, const imuBias &bias, double *yawRate, double acc[3])
+{
+  *yawRate = (data.rot[2] - bias.rot[2]) * dpsToRps;
+  acc[0] = (data.acc[1] - bias.acc[1]) * gravity;
+  acc[1] = -1 * ((data.acc[0] - bias.acc[0]) * gravity);
+  acc[2] = (data.acc[2] - bias.acc[2]) * gravity;
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+
+#include "robot_driver/imuPreintegration.h"
+
+//Bound to std::min's reference parameter in add
+constexpr double imuPreintegrator::maxSampleGap;
+
+/**
+* Adds a bias corrected sample
+* @param stamp   When it was measured in seconds
+* @param yawRate Yaw rate in rad/s
+* @param acc     Acceleration along x, y and z in m/s^2
+*/
+void imuPreintegrator::add(const double stamp, const double yawRate, const double acc[3])
+{
+  //Each sample stands for the time since the one before, FIFO stamps may step back across a drain
+  if (sums_.samples > 0)
+    sums_.yaw += yawRate * std::min(std::max(stamp - sums_.stamp, 0.0), maxSampleGap);
+
+  sums_.stamp = std::max(stamp, sums_.stamp);
+  sums_.samples++;
+
+  int product = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    sums_.acc[i] += acc[i];
+    for (int j = i; j < 3; j++)
+      sums_.accProducts[product++] += acc[i] * acc[j];
+  }
+
+  published_.store(sums_);
+}
+
+/**
+* Takes what the samples added since the last take measured
+* @param  window Filled with the samples since the last take
+* @return        False if no sample was added since
+*/
+bool imuPreintegrator::take(imuPreintegration *window)
+{
+  const imuIntegral sums = published_.load();
+
+  //The first take only sets where the next window starts
+  if (!takenValid_)
+  {
+    taken_ = sums;
+    takenValid_ = sums.samples > 0;
+    return false;
+  }
+
+  const double span = sums.stamp - taken_.stamp;
+  if (sums.samples == taken_.samples || span <= 0)
+    return false;
+
+  const int n = sums.samples - taken_.samples;
+  window->samples = n;
+  window->span = span;
+  window->deltaYaw = sums.yaw - taken_.yaw;
+  window->yawRate = window->deltaYaw / span;
+
+  //White noise averages down with the span, whatever the sample rate and filter; the bias doesn't
+  window->yawRateVariance = noise_.yawRateDensity / span + noise_.yawBiasVariance;
+
+  for (int i = 0; i < 3; i++)
+    window->acc[i] = (sums.acc[i] - taken_.acc[i]) / n;
+
+  int product = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = i; j < 3; j++)
+    {
+      //Spread of the samples over the window, then of their mean
+      double covariance = 0;
+      if (n >= 2)
+        covariance = ((sums.accProducts[product] - taken_.accProducts[product]) - n * window->acc[i] * window->acc[j]) / (n - 1) / n;
+      else if (i == j)
+        covariance = noise_.accVariance;
+
+      //Rounding in the running sums can't make a variance negative
+      if (i == j)
+        covariance = std::max(covariance, 0.0);
+
+      window->accCovariance[i * 3 + j] = window->accCovariance[j * 3 + i] = covariance;
+      product++;
+    }
+  }
+
+  taken_ = sums;
+  return true;
+}
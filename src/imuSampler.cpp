@@ -0,0 +1,373 @@
+#include <chrono>
+#include <cmath>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "robot_driver/imuSampler.h"
+
+imuSampler::imuSampler(const imuSamplerConfig &config):
+spi_(createSpiTransport(config.replay ? "sim" : config.spiBackend, config.csChannel, config.speed)),
+imu_(*spi_),
+useFifo_(config.useFifo),
+replay_(config.replay),
+calibrationFile_(config.calibrationFile),
+feed_(config.noise)
+{
+  //The recording brings its own bias model, a saved one stands in for recordings without it
+  if (replay_)
+  {
+    imuCalibration cached;
+    if (!calibrationFile_.empty() && loadImuCalibration(calibrationFile_, &cached))
+      trackedBias_ = cached.bias;
+    feed_.setBias(trackedBias_);
+
+    ROS_INFO("imuSampler: replaying recorded IMU samples");
+    return;
+  }
+
+  ROS_INFO("imuSampler: IMU INIT on %s SPI\n", config.spiBackend.c_str());
+
+  imuCalibration cached;
+  const bool haveCache = config.warmStart && !calibrationFile_.empty() && loadImuCalibration(calibrationFile_, &cached);
+
+  //A chip still set up from the last run needs neither the reset sequence nor its sleeps
+  const bool resumed = haveCache && resume(cached);
+
+  if (resumed)
+  {
+    ROS_INFO("imuSampler: IMU still configured from the last run, skipping reset");
+  }
+  else
+  {
+    // Init imu
+    imu_.init(1, BITS_DLPF_CFG_20HZ);
+
+    usleep(10000);
+
+    ROS_INFO("imuSampler: gyro scale = %d", imu_.set_gyro_scale(BITS_FS_500DPS));
+
+    usleep(50000);
+
+    ROS_INFO("imuSampler: accel scale = %d", imu_.set_acc_scale(BITS_FS_2G));
+
+    usleep(10000);
+    usleep(50000);
+  }
+
+  calibration_.hasChipState = true;
+  calibration_.whoami = imu_.whoami();
+  calibration_.registers = imu_.read_config();
+  calibration_.accDivider = imu_.acc_divider;
+  calibration_.gyroDivider = imu_.gyro_divider;
+
+  //Bias moves with temperature, so only trust a saved model close to temperatures it has seen
+  const float temperature = imu_.read_all().temp;
+  const bool biasValid = haveCache && cached.bias.covers(temperature, maxCachedTemperatureChange);
+
+  if (biasValid)
+  {
+    ROS_INFO("imuSampler: using saved IMU calibration from %s", calibrationFile_.c_str());
+    trackedBias_ = cached.bias;
+  }
+  else
+  {
+    //A saved slope still beats none
+    if (haveCache)
+      trackedBias_.slope = cached.bias.slope;
+
+    calibrate();
+  }
+
+  feed_.setBias(trackedBias_);
+
+  if (!resumed || !biasValid)
+    saveCalibration();
+
+  const imuBias bias = trackedBias_.at(temperature);
+  ROS_INFO("imuSampler: Channel 0 Bias: %lf", bias.acc[0]);
+  ROS_INFO("imuSampler: Channel 1 Bias: %lf", bias.acc[1]);
+  ROS_INFO("imuSampler: Channel 2 Bias: %lf", bias.acc[2]);
+
+  ROS_INFO("imuSampler: Channel 2 Rot Bias: %lf at %f C, %lf per C", bias.rot[2], temperature, trackedBias_.slope.rot[2]);
+
+  //Make sure the feed has a latest sample before the thread starts
+  feed_.setLatest(imu_.read_all());
+
+  if (useFifo_)
+  {
+    imu_.enable_fifo();
+    ROS_INFO("imuSampler: IMU FIFO enabled, sample period = %f s", imu_.sample_period());
+  }
+
+  if (!config.dataReadyChip.empty())
+  {
+    dataReady_ = createGpioEventSource(config.dataReadyChip, config.dataReadyLine, imu_.sample_period());
+    imu_.enable_data_ready_interrupt();
+    ROS_INFO("imuSampler: waking on data ready from %s line %d", config.dataReadyChip.c_str(), config.dataReadyLine);
+  }
+
+  ROS_INFO("imuSampler: IMU INIT DONE");
+}
+
+imuSampler::~imuSampler()
+{
+  stop();
+}
+
+/**
+* Starts the sampling thread
+*/
+void imuSampler::start()
+{
+  if (replay_ || running_.exchange(true))
+    return;
+
+  //The thread refines the bias from here on, a replay of the recording starts from the same model
+  if (recorder_ != nullptr)
+    recorder_->recordImuBias(trackedBias_, steadyNs(), ros::Time::now().toNSec());
+
+  thread_ = std::thread(&imuSampler::run, this);
+}
+
+/**
+* Stops and joins the sampling thread, then saves the refined calibration
+*/
+void imuSampler::stop()
+{
+  running_ = false;
+
+  if (!thread_.joinable())
+    return;
+
+  thread_.join();
+
+  if (biasTracker_.getUpdates() > 0)
+    saveCalibration();
+}
+
+/**
+* Starts over from a recorded bias model
+* @param model Recorded bias model
+*/
+void imuSampler::replayBias(const imuBiasModel &model)
+{
+  trackedBias_ = model;
+  biasTracker_.reset();
+  feed_.setBias(trackedBias_);
+}
+
+/**
+* Adopts the chip configuration from a saved calibration if the chip still has it
+* @param  cached Saved calibration
+* @return        True if the chip needs no initialization
+*/
+bool imuSampler::resume(const imuCalibration &cached)
+{
+  if (!cached.hasChipState || imu_.whoami() != cached.whoami || !imu_.resume(cached.registers))
+    return false;
+
+  //The file and the chip disagree about the scale, don't trust either
+  return imu_.acc_divider == cached.accDivider && imu_.gyro_divider == cached.gyroDivider;
+}
+
+/**
+* Estimates the bias at the current temperature from a short burst of samples, assuming the robot
+* stands still. Keeps the model's slope.
+*/
+void imuSampler::calibrate()
+{
+  ROS_INFO("imuSampler: IMU CALIBRATING");
+
+  //One burst per sample period so every read is a new sample
+  constexpr int imuSampleCount = 250;
+  const std::chrono::nanoseconds interval(static_cast<int64_t>(imu_.sample_period() * 1e9));
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+  imuStatistics statistics;
+  for (int i = 0; i < imuSampleCount; i++)
+  {
+    statistics.add(imu_.read_all());
+
+    next += interval;
+    std::this_thread::sleep_until(next);
+  }
+
+  trackedBias_.offset = statistics.mean();
+  trackedBias_.hasTemperature = true;
+  trackedBias_.referenceTemperature = statistics.meanTemperature();
+  trackedBias_.minTemperature = trackedBias_.maxTemperature = trackedBias_.referenceTemperature;
+
+  if (!imuBiasTracker::isStationary(statistics))
+    ROS_WARN("imuSampler: robot moved while calibrating (accel std %f g, gyro std %f dps), bias will be off until it stands still",
+             statistics.maxAccStdDev(), statistics.maxRotStdDev());
+
+  ROS_INFO("imuSampler: IMU CALIBRATION DONE");
+}
+
+/**
+* Saves the current bias if there is a calibration file
+*/
+void imuSampler::saveCalibration()
+{
+  if (calibrationFile_.empty())
+    return;
+
+  calibration_.bias = feed_.getBiasModel();
+
+  if (!saveImuCalibration(calibrationFile_, calibration_))
+    ROS_WARN("imuSampler: can't save IMU calibration to %s", calibrationFile_.c_str());
+}
+
+/**
+* Sampling thread main loop
+*/
+void imuSampler::run()
+{
+  //Sampling jitter shows up directly in the imu stamps, so ask for real-time priority
+  sched_param param;
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+    ROS_WARN("imuSampler: could not get real-time priority, sampling with normal priority");
+
+  const double samplePeriod = imu_.sample_period();
+
+  if (dataReady_)
+  {
+    //Wake when the chip has a sample instead of guessing from our own clock, so stamps don't
+    //beat against the chip's sample clock
+    int pending = 0;
+
+    while (running_)
+    {
+      const int edges = dataReady_->wait(dataReadyTimeoutMs);
+      if (edges == 0)
+      {
+        ROS_WARN_THROTTLE(5, "imuSampler: no data ready edge for %d ms", dataReadyTimeoutMs);
+        continue;
+      }
+
+      if (useFifo_)
+      {
+        //The FIFO keeps every sample, so only drain once there are enough of them
+        pending += edges;
+        if (pending < fifoDrainSamples)
+          continue;
+
+        pending = 0;
+        drainFifo(samplePeriod);
+      }
+      else
+      {
+        //The registers only hold the newest sample, the ones announced before it are gone
+        if (edges > 1)
+          missedSamples_.fetch_add(edges - 1, std::memory_order_relaxed);
+
+        readSample();
+      }
+    }
+
+    return;
+  }
+
+  const std::chrono::nanoseconds interval(static_cast<int64_t>(samplePeriod * (useFifo_ ? fifoDrainSamples : 1) * 1e9));
+
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+  while (running_)
+  {
+    if (useFifo_)
+      drainFifo(samplePeriod);
+    else
+      readSample();
+
+    //Don't try to catch up after a stall, that would just burst the bus
+    next += interval;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next < now)
+      next = now;
+
+    std::this_thread::sleep_until(next);
+  }
+}
+
+/**
+* Pushes every sample in the FIFO
+* @param samplePeriod Seconds between samples
+*/
+void imuSampler::drainFifo(const double samplePeriod)
+{
+  //The newest sample was taken at most one sample period before the drain
+  const ros::Time drainTime = ros::Time::now();
+  const int64_t drainNs = steadyNs();
+  const int count = imu_.read_fifo(&fifoSamples_[0], fifoSampleCapacity);
+
+  //The FIFO overflowed and was reset, everything in it is gone
+  if (count < 0)
+  {
+    missedSamples_.fetch_add(-count, std::memory_order_relaxed);
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    const double age = samplePeriod * (count - 1 - i);
+    imuSample sample;
+    sample.stamp = drainTime - ros::Duration(age);
+    sample.data = fifoSamples_[i];
+    push(sample, drainNs - static_cast<int64_t>(age * 1e9));
+  }
+}
+
+/**
+* Reads and pushes the sample in the sensor registers
+*/
+void imuSampler::readSample()
+{
+  imuSample sample;
+  sample.stamp = ros::Time::now();
+  const int64_t sampleNs = steadyNs();
+  sample.data = imu_.read_all();
+  push(sample, sampleNs);
+}
+
+/**
+* Hands a sample to the consumer and makes it the latest one
+* @param sample      IMU sample
+* @param monotonicNs When it was measured on the steady clock in nanoseconds, for the recorder
+*/
+void imuSampler::push(const imuSample &sample, const int64_t monotonicNs)
+{
+  if (recorder_ != nullptr)
+    recorder_->recordImu(sample.data, monotonicNs, sample.stamp.toNSec());
+
+  feed_.add(sample.stamp.toSec(), sample.data, trackedBias_.at(sample.data.temp));
+
+  if (biasTracker_.add(sample.data, &trackedBias_))
+    feed_.setBias(trackedBias_);
+
+  if (!ring_.push(sample))
+    overruns_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* Fills an IMU message from a sample, removing bias and rotating into base_link
+* @param sample IMU sample
+* @param imu    IMU message to fill
+*/
+void imuSampler::fillImu(const imuSample &sample, sensor_msgs::Imu *imu) const
+{
+  double yawRate, acc[3];
+  imuFeed::toBaseLink(sample.data, feed_.getBias(sample.data.temp), &yawRate, acc);
+  imu->header.stamp = sample.stamp;
+
+  imu->angular_velocity.x = 0;
+  imu->angular_velocity.y = 0;
+  imu->angular_velocity.z = yawRate;
+  imu->angular_velocity_covariance = emptyIMUCov;
+
+  imu->linear_acceleration.x = acc[0];
+  imu->linear_acceleration.y = acc[1];
+  imu->linear_acceleration.z = acc[2];
+  imu->linear_acceleration_covariance = emptyIMUCov;
+}
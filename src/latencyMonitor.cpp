@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+#include "robot_driver/latencyMonitor.h"
+
+//Name of each stage's duration, the arrival slot holds the whole pipeline
+static const char *stageNames[latencyMonitor::stageCount] =
+{
+  "total", "header_sync", "payload", "imu_read", "odometry", "publish"
+};
+
+/**
+* Adds a duration
+* @param duration Duration to add
+*/
+void latencyHistogram::record(const monotonicClock::duration duration)
+{
+  const int64_t signedMicros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  const uint64_t micros = signedMicros > 0 ? signedMicros : 0;
+
+  buckets_[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t max = maxMicros_.load(std::memory_order_relaxed);
+  while (micros > max && !maxMicros_.compare_exchange_weak(max, micros, std::memory_order_relaxed))
+    ;
+}
+
+/**
+* Returns quantiles of everything recorded since the last call and starts over
+*/
+latencyHistogram::summary latencyHistogram::takeSummary()
+{
+  boost::array<uint32_t, bucketCount> counts;
+  summary result = {0, 0, 0, 0};
+
+  for (int i = 0; i < bucketCount; i++)
+  {
+    counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+    result.count += counts[i];
+  }
+  result.max = maxMicros_.exchange(0, std::memory_order_relaxed);
+
+  if (result.count == 0)
+    return result;
+
+  //Counts needed to reach each quantile, rounded up so p99 of a few samples is the largest
+  const uint64_t p50Rank = (result.count + 1) / 2, p99Rank = (result.count * 99 + 99) / 100;
+  uint64_t seen = 0;
+
+  for (int i = 0; i < bucketCount; i++)
+  {
+    const uint64_t before = seen;
+    seen += counts[i];
+
+    if (before < p50Rank && seen >= p50Rank)
+      result.p50 = bucketMidpoint(i);
+    if (before < p99Rank && seen >= p99Rank)
+    {
+      result.p99 = bucketMidpoint(i);
+      break;
+    }
+  }
+
+  //A bucket midpoint can overshoot what was actually seen
+  result.p50 = std::min(result.p50, result.max);
+  result.p99 = std::min(result.p99, result.max);
+
+  return result;
+}
+
+/**
+* Maps microseconds to a bucket: exact below 4 us, then four buckets per power of two
+*/
+int latencyHistogram::bucketFor(const uint64_t micros)
+{
+  if (micros < subBuckets)
+    return micros;
+
+  const int msb = 63 - __builtin_clzll(micros);
+  const int bucket = subBuckets * (msb - 1) + ((micros >> (msb - 2)) & (subBuckets - 1));
+
+  return bucket < bucketCount ? bucket : bucketCount - 1;
+}
+
+/**
+* Middle of the range of microseconds a bucket covers
+*/
+double latencyHistogram::bucketMidpoint(const int bucket)
+{
+  if (bucket < subBuckets)
+    return bucket;
+
+  const int msb = bucket / subBuckets + 1, sub = bucket % subBuckets;
+  const double width = 1 << (msb - 2);
+
+  return (subBuckets + sub) * width + width / 2;
+}
+
+/**
+* Records the current frame's stage durations. Call once its odometry is published.
+*/
+void latencyMonitor::frameDone()
+{
+  for (int s = headerSync; s < stageCount; s++)
+    histograms_[s].record(marks_[s] - marks_[s - 1]);
+
+  histograms_[arrival].record(marks_[published] - marks_[arrival]);
+}
+
+/**
+* Fills a diagnostic status with p50/p99/max per stage since the last call
+* @param status Status to fill
+*/
+void latencyMonitor::fillDiagnostics(diagnostic_msgs::DiagnosticStatus *status)
+{
+  status->level = diagnostic_msgs::DiagnosticStatus::OK;
+  status->name = "robot_driver: frame latency";
+  status->values.clear();
+
+  uint64_t frames = 0;
+  char value[32];
+
+  for (int s = 0; s < stageCount; s++)
+  {
+    const latencyHistogram::summary summary = histograms_[s].takeSummary();
+    const double quantiles[3] = {summary.p50, summary.p99, summary.max};
+    static const char *quantileNames[3] = {"p50", "p99", "max"};
+
+    if (s == arrival)
+      frames = summary.count;
+
+    for (int q = 0; q < 3; q++)
+    {
+      diagnostic_msgs::KeyValue keyValue;
+      keyValue.key = std::string(stageNames[s]) + " " + quantileNames[q] + " (us)";
+      std::snprintf(value, sizeof(value), "%.0f", quantiles[q]);
+      keyValue.value = value;
+      status->values.push_back(keyValue);
+    }
+  }
+
+  std::snprintf(value, sizeof(value), "%lu frames", (unsigned long)frames);
+  status->message = value;
+}
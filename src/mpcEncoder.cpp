@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "robot_driver/mpcEncoder.h"
+
+namespace
+{
+  //Truncates like the original encoder's int32 conversion did
+  int32_t toMm(const double meters)
+  {
+    return static_cast<int32_t>(meters * 1000);
+  }
+
+  int16_t toMm16(const double meters)
+  {
+    return static_cast<int16_t>(std::max<int32_t>(INT16_MIN, std::min<int32_t>(INT16_MAX, toMm(meters))));
+  }
+
+  //Bytes a zigzag varint of a value takes
+  size_t varintLength(const uint32_t zigzag)
+  {
+    return zigzag < (1u << 7) ? 1 : zigzag < (1u << 14) ? 2 : zigzag < (1u << 21) ? 3 : zigzag < (1u << 28) ? 4 : 5;
+  }
+
+  uint32_t zigzag(const int32_t value)
+  {
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+  }
+
+  int32_t unzigzag(const uint32_t value)
+  {
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+  }
+
+  uint8_t *putVarint(uint8_t *data, uint32_t value)
+  {
+    while (value >= 0x80)
+    {
+      *data++ = static_cast<uint8_t>(value) | 0x80;
+      value >>= 7;
+    }
+    *data++ = static_cast<uint8_t>(value);
+    return data;
+  }
+
+  //False if the varint runs past end or is too long
+  bool getVarint(const uint8_t **data, const uint8_t *end, uint32_t *value)
+  {
+    *value = 0;
+    for (int shift = 0; shift < 35 && *data < end; shift += 7)
+    {
+      const uint8_t byte = *(*data)++;
+      *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+}
+
+/**
+* Encodes objects the way protocol version 1 sends them
+* @param  objects Objects
+* @param  count   Number of objects
+* @param  data    Filled with mpcLegacyLength bytes
+* @return         Number of objects encoded
+*/
+int encodeMpcLegacy(const mpcObject *objects, const int count, uint8_t *data)
+{
+  const int encoded = std::min(count, mpcLegacyObjects);
+  std::memset(data, 0xFF, mpcLegacyLength);
+
+  for (int i = 0; i < encoded; i++)
+  {
+    uint8_t *slot = data + i * mpcLegacySlotLength;
+    const int32_t x = toMm(objects[i].x), y = toMm(objects[i].y);
+    std::memcpy(slot, &x, 4);
+    std::memcpy(slot + 4, &y, 4);
+    slot[8] = objects[i].kind;
+  }
+
+  return encoded;
+}
+
+/**
+* Encodes objects the way protocol version 2 sends them
+* @param  objects Objects
+* @param  count   Number of objects
+* @param  robotX  Robot x in the field frame in m
+* @param  robotY  Robot y in the field frame in m
+* @param  data    Filled with the payload
+* @param  length  Set to the payload length
+* @return         Number of objects encoded
+*/
+int encodeMpcCompact(const mpcObject *objects, const int count, const double robotX, const double robotY,
+                     uint8_t *data, size_t *length)
+{
+  const int16_t originX = toMm16(robotX), originY = toMm16(robotY);
+  uint8_t *out = data + mpcCompactHeaderLength, *const end = data + cortexFrame::maxPayloadLength;
+
+  int encoded = 0;
+  for (; encoded < count && encoded < 255; encoded++)
+  {
+    const uint32_t dx = zigzag(toMm(objects[encoded].x) - originX), dy = zigzag(toMm(objects[encoded].y) - originY);
+    if (out + varintLength(dx) + varintLength(dy) + 1 > end)
+      break;
+
+    out = putVarint(out, dx);
+    out = putVarint(out, dy);
+    *out++ = objects[encoded].kind;
+  }
+
+  *length = out - data;
+  data[0] = *length - 1;
+  data[1] = encoded;
+  std::memcpy(data + 2, &originX, 2);
+  std::memcpy(data + 4, &originY, 2);
+  return encoded;
+}
+
+/**
+* Encodes objects both ways
+* @param objects Objects
+* @param count   Number of objects
+* @param robotX  Robot x in the field frame in m
+* @param robotY  Robot y in the field frame in m
+* @param message Filled with both encodings
+*/
+void encodeMpcMessage(const mpcObject *objects, const int count, const double robotX, const double robotY,
+                      mpcMessage *message)
+{
+  size_t length;
+  message->inputCount = count;
+  message->legacyCount = encodeMpcLegacy(objects, count, message->legacy);
+  message->compactCount = encodeMpcCompact(objects, count, robotX, robotY, message->compact, &length);
+  message->compactLength = length;
+}
+
+/**
+* Decodes an MPC payload, as the cortex would
+* @param  data     Payload
+* @param  length   Payload length
+* @param  version  Protocol version it was encoded for
+* @param  objects  Filled with the objects
+* @param  capacity Room in objects
+* @param  count    Set to the number of objects
+* @return          False if the payload is malformed or holds more than capacity objects
+*/
+bool decodeMpcObjects(const uint8_t *data, const size_t length, const int version, mpcObject *objects,
+                      const int capacity, int *count)
+{
+  *count = 0;
+
+  if (version < 2)
+  {
+    if (length != size_t(mpcLegacyLength))
+      return false;
+
+    static const uint8_t empty[mpcLegacySlotLength] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    for (int i = 0; i < mpcLegacyObjects; i++)
+    {
+      const uint8_t *slot = data + i * mpcLegacySlotLength;
+      if (std::memcmp(slot, empty, mpcLegacySlotLength) == 0)
+        break;
+      if (*count == capacity)
+        return false;
+
+      int32_t x, y;
+      std::memcpy(&x, slot, 4);
+      std::memcpy(&y, slot + 4, 4);
+      objects[*count].x = x / 1000.0;
+      objects[*count].y = y / 1000.0;
+      objects[*count].kind = slot[8];
+      (*count)++;
+    }
+    return true;
+  }
+
+  if (length < size_t(mpcCompactHeaderLength) || data[0] != length - 1 || data[1] > capacity)
+    return false;
+
+  int16_t originX, originY;
+  std::memcpy(&originX, data + 2, 2);
+  std::memcpy(&originY, data + 4, 2);
+
+  const uint8_t *in = data + mpcCompactHeaderLength, *const end = data + length;
+  for (int i = 0; i < data[1]; i++)
+  {
+    uint32_t dx, dy;
+    if (!getVarint(&in, end, &dx) || !getVarint(&in, end, &dy) || in == end)
+      return false;
+
+    objects[i].x = (originX + unzigzag(dx)) / 1000.0;
+    objects[i].y = (originY + unzigzag(dy)) / 1000.0;
+    objects[i].kind = *in++;
+  }
+
+  *count = data[1];
+  return in == end;
+}
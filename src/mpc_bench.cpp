@@ -0,0 +1,129 @@
+/**
+ * Checks the MPC reply encodings round trip and times encoding and decoding them.
+ *
+ * Usage: mpc_bench
+ *
+ * Object lists of growing size are scattered over the field around the robot. For each size the
+ * legacy and compact payloads are encoded and decoded again, checked against the objects to the
+ * mm, and timed. The bytes column is what goes over the UART, frame header and checksum included,
+ * with the time that takes at 115200 baud. Last, a list of mpcMaxObjects right next to the robot
+ * must fit a single payload. Exits with 1 if any round trip failed.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "robot_driver/mpcEncoder.h"
+
+//Field is 3.66 m square, objects are spread around the robot in the middle of it
+static void scatter(mpcObject *objects, const int count, const unsigned seed)
+{
+  std::srand(seed);
+  for (int i = 0; i < count; i++)
+  {
+    objects[i].x = 0.1 + 3.46 * std::rand() / RAND_MAX;
+    objects[i].y = 0.1 + 3.46 * std::rand() / RAND_MAX;
+    objects[i].kind = std::rand() % 4;
+  }
+}
+
+//Whether decoded objects match the encoded ones to the mm
+static bool matches(const mpcObject *objects, const mpcObject *decoded, const int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (std::lround(std::trunc(objects[i].x * 1000)) != std::lround(decoded[i].x * 1000) ||
+        std::lround(std::trunc(objects[i].y * 1000)) != std::lround(decoded[i].y * 1000) ||
+        objects[i].kind != decoded[i].kind)
+      return false;
+  }
+  return true;
+}
+
+int main()
+{
+  typedef std::chrono::steady_clock benchClock;
+  const int iterations = 200000;
+  const double robotX = 1.83, robotY = 1.83;
+  const int frameOverhead = cortexFrameParser::headerLength + cortexFrameParser::crcLength;
+
+  static const int counts[] = {0, 1, 3, 8, 16, 32, mpcMaxObjects};
+  bool passed = true;
+
+  std::printf("objects  version  encoded  bytes  uart_ms  encode_ns  decode_ns  round_trip\n");
+
+  for (const int count : counts)
+  {
+    mpcObject objects[mpcMaxObjects], decoded[mpcMaxObjects];
+    scatter(objects, count, count + 1);
+
+    for (int version = 1; version <= 2; version++)
+    {
+      uint8_t payload[cortexFrame::maxPayloadLength];
+      size_t length = 0;
+      int encoded = 0;
+
+      //Keep the compiler from hoisting the work out of the loops
+      volatile unsigned sink = 0;
+
+      const benchClock::time_point encodeStart = benchClock::now();
+      for (int i = 0; i < iterations; i++)
+      {
+        objects[0].kind = i & 3;
+        if (version == 1)
+        {
+          encoded = encodeMpcLegacy(objects, count, payload);
+          length = mpcLegacyLength;
+        }
+        else
+        {
+          encoded = encodeMpcCompact(objects, count, robotX, robotY, payload, &length);
+        }
+        sink += payload[length - 1];
+      }
+      const double encodeNs = std::chrono::duration<double, std::nano>(benchClock::now() - encodeStart).count() / iterations;
+
+      int decodedCount = 0;
+      bool ok = true;
+      const benchClock::time_point decodeStart = benchClock::now();
+      for (int i = 0; i < iterations; i++)
+      {
+        ok &= decodeMpcObjects(payload, length, version, decoded, mpcMaxObjects, &decodedCount);
+        sink += decodedCount;
+      }
+      const double decodeNs = std::chrono::duration<double, std::nano>(benchClock::now() - decodeStart).count() / iterations;
+
+      ok &= decodedCount == encoded && matches(objects, decoded, encoded);
+      passed &= ok;
+
+      //10 bits per byte on the wire
+      const size_t bytes = length + frameOverhead;
+      std::printf("%7d  %7d  %7d  %5zu  %7.2f  %9.1f  %9.1f  %s\n", count, version, encoded, bytes,
+                  bytes * 10 * 1000.0 / 115200, encodeNs, decodeNs, ok ? "ok" : "FAILED");
+    }
+  }
+
+  //A full frame of objects right next to the robot takes mpcMaxObjects
+  mpcObject close[mpcMaxObjects], decoded[mpcMaxObjects];
+  for (int i = 0; i < mpcMaxObjects; i++)
+  {
+    close[i].x = robotX + 0.001 * (i % 50);
+    close[i].y = robotY - 0.001 * (i / 50);
+    close[i].kind = i % 4;
+  }
+
+  uint8_t payload[cortexFrame::maxPayloadLength];
+  size_t length;
+  int decodedCount = 0;
+  const int encoded = encodeMpcCompact(close, mpcMaxObjects, robotX, robotY, payload, &length);
+  const bool closeOk = encoded == mpcMaxObjects &&
+                       decodeMpcObjects(payload, length, 2, decoded, mpcMaxObjects, &decodedCount) &&
+                       decodedCount == encoded && matches(close, decoded, encoded);
+  std::printf("%d objects within 63 mm: %d encoded in %zu bytes, %s\n", mpcMaxObjects, encoded, length,
+              closeOk ? "ok" : "FAILED");
+  passed &= closeOk;
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include "robot_driver/MPU6000.h"
+#include "robot_driver/mpu6000Sim.h"
+
+//Samples generated per transaction are capped so a long pause overflows the FIFO like the chip does
+constexpr int maxSamplesPerUpdate = 128;
+
+//Stationary board: 1g on Z, a small constant gyro offset and some white noise
+constexpr float gyroBiasDps[3] = {0.3, -0.2, 0.5};
+constexpr float accNoiseG = 0.002, gyroNoiseDps = 0.05, dieTemperature = 30.0;
+
+mpu6000Sim::mpu6000Sim():
+rng_(42),
+noise_(0, 1)
+{
+  reset();
+}
+
+/**
+* Puts every register back to its power on value
+*/
+void mpu6000Sim::reset()
+{
+  regs_.fill(0);
+  regs_[MPUREG_PWR_MGMT_1] = BIT_SLEEP;
+  regs_[MPUREG_WHOAMI] = 0x68;
+
+  fifoHead_ = 0;
+  fifoCount_ = 0;
+  fifoOverflow_ = false;
+
+  lastSample_ = std::chrono::steady_clock::now();
+}
+
+/**
+* One SPI transaction with chip select held for its whole length
+* @param data   Bytes to send, replaced by the bytes received
+* @param length Number of bytes
+*/
+void mpu6000Sim::transfer(uint8_t *data, const size_t length)
+{
+  if (length < 1)
+    return;
+
+  update();
+
+  //The driver's write()/write(0x00) pairs send a read command and its dummy byte as two
+  //transactions, treat the second one as the continuation of the read
+  if (pendingRead_ && data[0] == 0x00)
+  {
+    pendingRead_ = false;
+    for (size_t i = 0; i < length; i++)
+      data[i] = readByte(&pendingReg_);
+    return;
+  }
+
+  uint8_t reg = data[0] & 0x7F;
+  const bool isRead = data[0] & READ_FLAG;
+  data[0] = 0;
+
+  pendingRead_ = isRead && length == 1;
+  pendingReg_ = reg;
+
+  for (size_t i = 1; i < length; i++)
+  {
+    if (isRead)
+    {
+      data[i] = readByte(&reg);
+    }
+    else
+    {
+      writeByte(reg, data[i]);
+      data[i] = 0;
+      reg = (reg + 1) & 0x7F;
+    }
+  }
+}
+
+/**
+* Generates the samples the chip would have taken since the last transaction
+*/
+void mpu6000Sim::update()
+{
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  if (regs_[MPUREG_PWR_MGMT_1] & BIT_SLEEP)
+  {
+    lastSample_ = now;
+    return;
+  }
+
+  const int lowPass = regs_[MPUREG_CONFIG] & BITS_DLPF_CFG_MASK;
+  const double gyroRate = (lowPass == BITS_DLPF_CFG_256HZ_NOLPF2 || lowPass == BITS_DLPF_CFG_2100HZ_NOLPF) ? 8000 : 1000;
+  const std::chrono::nanoseconds period(static_cast<int64_t>(1e9 * (1 + regs_[MPUREG_SMPLRT_DIV]) / gyroRate));
+
+  int64_t count = (now - lastSample_) / period;
+  if (count == 0)
+    return;
+
+  lastSample_ += count * period;
+  if (count > maxSamplesPerUpdate)
+    count = maxSamplesPerUpdate;
+
+  const float accLsb = 16384 >> ((regs_[MPUREG_ACCEL_CONFIG] & BITS_FS_MASK) >> 3);
+  const float gyroLsb = 131.0 / (1 << ((regs_[MPUREG_GYRO_CONFIG] & BITS_FS_MASK) >> 3));
+
+  for (int64_t sample = 0; sample < count; sample++)
+  {
+    int16_t words[7];
+    words[0] = accNoiseG * noise_(rng_) * accLsb;
+    words[1] = accNoiseG * noise_(rng_) * accLsb;
+    words[2] = (1 + accNoiseG * noise_(rng_)) * accLsb;
+    words[3] = (dieTemperature - 36.53) * 340;
+    for (int axis = 0; axis < 3; axis++)
+      words[4 + axis] = (gyroBiasDps[axis] + gyroNoiseDps * noise_(rng_)) * gyroLsb;
+
+    for (int i = 0; i < 7; i++)
+    {
+      regs_[MPUREG_ACCEL_XOUT_H + i * 2] = (uint16_t)words[i] >> 8;
+      regs_[MPUREG_ACCEL_XOUT_H + i * 2 + 1] = (uint16_t)words[i] & 0xFF;
+    }
+
+    if (!(regs_[MPUREG_USER_CTRL] & BIT_FIFO_EN))
+      continue;
+
+    //Queue the enabled words in register order
+    const uint8_t enabled = regs_[MPUREG_FIFO_EN];
+    const bool wordEnabled[7] =
+    {
+      (enabled & BIT_ACCEL_FIFO_EN) != 0, (enabled & BIT_ACCEL_FIFO_EN) != 0, (enabled & BIT_ACCEL_FIFO_EN) != 0,
+      (enabled & BIT_TEMP_FIFO_EN) != 0,
+      (enabled & BIT_XG_FIFO_EN) != 0, (enabled & BIT_YG_FIFO_EN) != 0, (enabled & BIT_ZG_FIFO_EN) != 0
+    };
+
+    for (int i = 0; i < 7; i++)
+    {
+      if (!wordEnabled[i])
+        continue;
+
+      for (int half = 0; half < 2; half++)
+      {
+        if (fifoCount_ == (int)fifo_.size())
+        {
+          //Full, the oldest byte is lost
+          fifoOverflow_ = true;
+          fifoHead_ = (fifoHead_ + 1) % fifo_.size();
+          fifoCount_--;
+        }
+
+        fifo_[(fifoHead_ + fifoCount_) % fifo_.size()] = regs_[MPUREG_ACCEL_XOUT_H + i * 2 + half];
+        fifoCount_++;
+      }
+    }
+  }
+}
+
+/**
+* Reads one byte for a read transaction
+* @param  reg Register address, incremented unless it is the FIFO port
+* @return     Register value
+*/
+uint8_t mpu6000Sim::readByte(uint8_t *reg)
+{
+  uint8_t value;
+
+  switch (*reg)
+  {
+    case MPUREG_FIFO_R_W:
+    {
+      if (fifoCount_ == 0)
+        return 0;
+
+      value = fifo_[fifoHead_];
+      fifoHead_ = (fifoHead_ + 1) % fifo_.size();
+      fifoCount_--;
+      return value;
+    }
+
+    case MPUREG_FIFO_COUNTH:
+      value = (fifoOverflow_ ? fifo_.size() : fifoCount_) >> 8;
+      break;
+
+    case MPUREG_FIFO_COUNTL:
+      value = (fifoOverflow_ ? fifo_.size() : fifoCount_) & 0xFF;
+      break;
+
+    default:
+      value = regs_[*reg];
+      break;
+  }
+
+  *reg = (*reg + 1) & 0x7F;
+  return value;
+}
+
+/**
+* Writes one register, applying side effects like resets
+* @param reg   Register address
+* @param value New value
+*/
+void mpu6000Sim::writeByte(const uint8_t reg, const uint8_t value)
+{
+  switch (reg)
+  {
+    case MPUREG_PWR_MGMT_1:
+      if (value & BIT_H_RESET)
+        reset();
+      else
+        regs_[reg] = value;
+      break;
+
+    case MPUREG_USER_CTRL:
+      if (value & BIT_FIFO_RESET)
+      {
+        fifoHead_ = 0;
+        fifoCount_ = 0;
+        fifoOverflow_ = false;
+      }
+      regs_[reg] = value & ~BIT_FIFO_RESET;
+      break;
+
+    case MPUREG_WHOAMI:
+      break;
+
+    default:
+      regs_[reg] = value;
+      break;
+  }
+}
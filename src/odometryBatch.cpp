@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "robot_driver/odometryBatch.h"
+
+/**
+* Takes a log of counts, the first entry is only the starting point like after a reset
+* @param leftCounts  Cumulative left quad counts
+* @param rightCounts Cumulative right quad counts
+* @param dts         Time since the previous entry in seconds
+* @param count       Entries in each column
+*/
+void odometryBatch::load(const int32_t *leftCounts, const int32_t *rightCounts, const double *dts, const size_t count)
+{
+  const size_t steps = count > 0 ? count - 1 : 0;
+  halfSum_.resize(steps);
+  halfDiff_.resize(steps);
+  rate_.resize(steps);
+
+  double *__restrict halfSum = halfSum_.data();
+  double *__restrict halfDiff = halfDiff_.data();
+  double *__restrict rate = rate_.data();
+
+  //Reciprocals once here so each integration only multiplies. A dt that isn't positive is
+  //clamped and masked to a rate of 0 rather than branched around, so the loop vectorizes.
+  for (size_t i = 0; i < steps; i++)
+  {
+    const double dt = std::max(DBL_MIN, dts[i + 1]);
+    const double valid = dts[i + 1] > 0 ? 1.0 : 0.0;
+    rate[i] = valid / dt;
+  }
+
+  //Unsigned subtraction so the deltas survive the counters wrapping
+  for (size_t i = 0; i < steps; i++)
+  {
+    const int32_t left = static_cast<int32_t>(static_cast<uint32_t>(leftCounts[i + 1]) - static_cast<uint32_t>(leftCounts[i]));
+    const int32_t right = static_cast<int32_t>(static_cast<uint32_t>(rightCounts[i + 1]) - static_cast<uint32_t>(rightCounts[i]));
+    halfSum[i] = (left + right) * 0.5;
+    halfDiff[i] = (right - left) * 0.5;
+  }
+}
+
+/**
+* Integrates every step
+* @param geometry   Conversions to use, the noise isn't needed
+* @param trajectory Filled with the trajectory, its columns are reused between calls
+* @param x          Starting X position in meters
+* @param y          Starting Y position in meters
+* @param theta      Starting heading in radians
+*/
+void odometryBatch::integrate(const diffDriveGeometry &geometry, odometryTrajectory *trajectory,
+                              const double x, const double y, const double theta) const
+{
+  const size_t steps = rate_.size();
+  trajectory->x.resize(steps);
+  trajectory->y.resize(steps);
+  trajectory->theta.resize(steps);
+  trajectory->linearVelocity.resize(steps);
+  trajectory->angularVelocity.resize(steps);
+
+  const double *__restrict halfSum = halfSum_.data();
+  const double *__restrict halfDiff = halfDiff_.data();
+  const double *__restrict rate = rate_.data();
+  double *__restrict xs = trajectory->x.data();
+  double *__restrict ys = trajectory->y.data();
+  double *__restrict thetas = trajectory->theta.data();
+  double *__restrict v = trajectory->linearVelocity.data();
+  double *__restrict omega = trajectory->angularVelocity.data();
+
+  const double metersPerCount = geometry.straightConversion / 1000, radiansPerCount = geometry.thetaConversion;
+
+  //Distance and turn of each step, parked in the velocity columns until the end
+  for (size_t i = 0; i < steps; i++)
+  {
+    v[i] = halfSum[i] * metersPerCount;
+    omega[i] = halfDiff[i] * radiansPerCount;
+  }
+
+  //Heading after each step is a prefix sum of the turns. Unwrapped, so it stays exact however far it turns.
+  double heading = theta;
+  for (size_t i = 0; i < steps; i++)
+  {
+    heading += omega[i];
+    thetas[i] = heading;
+  }
+
+  //Chord of each arc at its mid heading. A step rarely turns more than a few degrees, where a
+  //short series for sin(half) / half is exact to double precision and saves a call to sin.
+  for (size_t i = 0; i < steps; i++)
+  {
+    const double half = omega[i] / 2, mid = thetas[i] - half, half2 = half * half;
+    const double sinc = std::fabs(half) < 0.1 ? 1 - half2 / 6 * (1 - half2 / 20 * (1 - half2 / 42))
+                                               : std::sin(half) / half;
+    const double chord = v[i] * sinc;
+    xs[i] = chord * std::cos(mid);
+    ys[i] = chord * std::sin(mid);
+  }
+
+  //Positions are prefix sums of the chords
+  double px = x, py = y;
+  for (size_t i = 0; i < steps; i++)
+  {
+    px += xs[i];
+    py += ys[i];
+    xs[i] = px;
+    ys[i] = py;
+  }
+
+  for (size_t i = 0; i < steps; i++)
+  {
+    v[i] *= rate[i];
+    omega[i] *= rate[i];
+  }
+
+  for (size_t i = 0; i < steps; i++)
+    thetas[i] = std::remainder(thetas[i], 2 * M_PI);
+}
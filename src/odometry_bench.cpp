@@ -0,0 +1,210 @@
+/**
+ * Checks diffDriveOdometry against synthetic trajectories and times its update.
+ *
+ * Usage: odometry_bench
+ *
+ * Each trajectory is driven with smoothly varying wheel speeds for a minute. The true pose
+ * follows the continuous wheel motion in 0.1 ms steps, while the odometry only sees whole quad
+ * counts every 15 ms like the cortex sends them. The float forward Euler integration the
+ * driver used before runs alongside for comparison, and so does the arc fused with a simulated
+ * 500 Hz gyro with white noise and a leftover bias, pre-integrated between frames. On the slip
+ * trajectory the right wheel counts 3% more than it moves.
+ *
+ * Exits with 1 if the arc's final error on a trajectory without slip exceeds 2 mm or 0.05 degrees,
+ * or if odometryBatch integrating the same counts ends more than 1 um or 1e-9 rad away from it.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "robot_driver/diffDriveOdometry.h"
+#include "robot_driver/imuPreintegration.h"
+#include "robot_driver/odometryBatch.h"
+
+struct trajectory
+{
+  const char *name;
+  double (*v)(double t);     //m/s
+  double (*omega)(double t); //rad/s
+  double rightSlip;          //extra right counts per count moved
+};
+
+static double straightV(double) { return 0.5; }
+static double straightOmega(double) { return 0; }
+static double circleV(double) { return 0.5; }
+static double circleOmega(double) { return 0.5; }
+static double slalomV(double t) { return 0.4 + 0.2 * std::sin(0.3 * t); }
+static double slalomOmega(double t) { return 1.2 * std::sin(0.8 * t); }
+static double spinV(double) { return 0; }
+static double spinOmega(double t) { return 2.0 * std::cos(0.2 * t); }
+
+static const trajectory trajectories[] =
+{
+  {"straight", straightV, straightOmega, 0},
+  {"circle", circleV, circleOmega, 0},
+  {"slalom", slalomV, slalomOmega, 0},
+  {"spin", spinV, spinOmega, 0},
+  {"slip", slalomV, slalomOmega, 0.03},
+};
+
+//Final pose error of the arc against the truth, they are 0.3 to 0.8 mm
+constexpr double maxArcError = 0.002, maxArcThetaError = 0.05 * M_PI / 180;
+
+//odometryBatch sums in another order, it must still end in the same place
+constexpr double maxBatchError = 1e-6, maxBatchThetaError = 1e-9;
+
+static double wrapAngle(const double angle)
+{
+  return std::remainder(angle, 2 * M_PI);
+}
+
+/**
+ * Runs one trajectory and prints the final errors of all integrations
+ * @return False if the arc or the batch integration is off by more than its tolerance
+ */
+static bool checkTrajectory(const trajectory &path, const diffDriveGeometry &geometry, const imuNoise &noise)
+{
+  constexpr double duration = 60, frameDt = 0.015, truthDt = 0.0001, gyroDt = 0.002;
+  const double metersPerCount = geometry.straightConversion / 1000;
+
+  //White noise of one sample at the gyro's rate, plus the bias calibration left behind
+  std::mt19937 random(1);
+  std::normal_distribution<double> gyroNoise(0, std::sqrt(noise.yawRateDensity / (2 * gyroDt)));
+  const double gyroBias = std::sqrt(noise.yawBiasVariance);
+  const int stepsPerGyro = std::lround(gyroDt / truthDt);
+  const double gravityAcc[3] = {0, 0, 9.80665};
+  int steps = 0;
+
+  //Continuous truth
+  double left = 0, right = 0, x = 0, y = 0, theta = 0;
+
+  diffDriveOdometry odometry(geometry), fused(geometry);
+  odometry.update(0, 0, frameDt);
+
+  //The same counts for odometryBatch, starting from the same zero counts
+  std::vector<int32_t> leftCounts(1, 0), rightCounts(1, 0);
+  std::vector<double> dts(1, frameDt);
+  fused.update(0, 0, frameDt);
+
+  imuPreintegrator preintegrator(noise);
+  imuPreintegration window;
+  preintegrator.take(&window);
+
+  //The old float integration
+  float eulerX = 0, eulerY = 0, eulerTheta = 0;
+  int32_t lastLeft = 0, lastRight = 0;
+
+  const int stepsPerFrame = std::lround(frameDt / truthDt);
+  double maxError = 0;
+
+  for (double t = 0; t < duration; t += frameDt)
+  {
+    for (int step = 0; step < stepsPerFrame; step++)
+    {
+      const double ts = t + step * truthDt, v = path.v(ts), omega = path.omega(ts);
+
+      //Wheel counts per second for this motion
+      left += (v / metersPerCount - omega / geometry.thetaConversion) * truthDt;
+      right += (v / metersPerCount + omega / geometry.thetaConversion) * truthDt * (1 + path.rightSlip);
+
+      if (steps++ % stepsPerGyro == 0)
+        preintegrator.add(ts, omega + gyroBias + gyroNoise(random), gravityAcc);
+
+      const double dtheta = omega * truthDt, ds = v * truthDt;
+      const double chord = std::fabs(dtheta) > 1e-12 ? ds * std::sin(dtheta / 2) / (dtheta / 2) : ds;
+      x += chord * std::cos(theta + dtheta / 2);
+      y += chord * std::sin(theta + dtheta / 2);
+      theta += dtheta;
+    }
+
+    const int32_t leftCount = std::floor(left), rightCount = std::floor(right);
+    odometry.update(leftCount, rightCount, frameDt);
+    leftCounts.push_back(leftCount);
+    rightCounts.push_back(rightCount);
+    dts.push_back(frameDt);
+    maxError = std::max(maxError, std::hypot(odometry.x() - x, odometry.y() - y));
+
+    if (preintegrator.take(&window))
+      fused.update(leftCount, rightCount, frameDt, window.yawOver(frameDt), window.yawVarianceOver(frameDt));
+    else
+      fused.update(leftCount, rightCount, frameDt);
+
+    const int32_t leftDelta = leftCount - lastLeft, rightDelta = rightCount - lastRight;
+    lastLeft = leftCount;
+    lastRight = rightCount;
+
+    const float dist = ((rightDelta + leftDelta) / 2.0 * geometry.straightConversion) / 1000.0,
+                dtheta = (rightDelta - leftDelta) / 2.0 * geometry.thetaConversion;
+    eulerTheta += dtheta;
+    eulerX += std::cos(eulerTheta) * dist;
+    eulerY += std::sin(eulerTheta) * dist;
+  }
+
+  const diffDriveOdometry::poseCovariance &cov = odometry.getPoseCovariance();
+
+  std::printf("%-9s arc: %8.2f mm %7.4f deg (max %6.2f mm, 1 sigma %7.2f mm)   euler: %8.2f mm %7.4f deg   gyro: %8.2f mm %7.4f deg\n",
+              path.name,
+              1000 * std::hypot(odometry.x() - x, odometry.y() - y),
+              wrapAngle(odometry.theta() - theta) * 180 / M_PI,
+              1000 * maxError,
+              1000 * std::sqrt(cov[0] + cov[4]),
+              1000 * std::hypot(eulerX - x, eulerY - y),
+              wrapAngle(eulerTheta - theta) * 180 / M_PI,
+              1000 * std::hypot(fused.x() - x, fused.y() - y),
+              wrapAngle(fused.theta() - theta) * 180 / M_PI);
+
+  odometryBatch batch;
+  odometryTrajectory batchTrajectory;
+  batch.load(leftCounts.data(), rightCounts.data(), dts.data(), leftCounts.size());
+  batch.integrate(geometry, &batchTrajectory);
+
+  bool passed = true;
+  const double arcError = std::hypot(odometry.x() - x, odometry.y() - y),
+               arcThetaError = std::fabs(wrapAngle(odometry.theta() - theta));
+  if (path.rightSlip == 0 && (arcError > maxArcError || arcThetaError > maxArcThetaError))
+  {
+    std::printf("FAILED: %s arc is off by %.2f mm %.4f deg\n", path.name, 1000 * arcError, arcThetaError * 180 / M_PI);
+    passed = false;
+  }
+
+  const double batchError = std::hypot(batchTrajectory.x.back() - odometry.x(), batchTrajectory.y.back() - odometry.y()),
+               batchThetaError = std::fabs(wrapAngle(batchTrajectory.theta.back() - odometry.theta()));
+  if (batchError > maxBatchError || batchThetaError > maxBatchThetaError)
+  {
+    std::printf("FAILED: %s odometryBatch ends %g m %g rad from diffDriveOdometry\n", path.name, batchError, batchThetaError);
+    passed = false;
+  }
+
+  return passed;
+}
+
+int main()
+{
+  const diffDriveGeometry geometry;
+  const imuNoise noise;
+
+  std::printf("final pose error after 60 s, %.4f m track width\n", geometry.trackWidth());
+  bool passed = true;
+  for (const trajectory &path : trajectories)
+    passed &= checkTrajectory(path, geometry, noise);
+
+  //Time the update on a slalom of counts
+  constexpr int updates = 10000000;
+  diffDriveOdometry odometry(geometry);
+  int32_t left = 0, right = 0;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < updates; i++)
+  {
+    left += 10 + (i & 7);
+    right += 14 - (i & 3);
+    odometry.update(left, right, 0.015);
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::printf("update: %.1f ns (x %.3f to keep the loop alive)\n", 1e9 * seconds / updates, odometry.x());
+  return passed ? 0 : 1;
+}
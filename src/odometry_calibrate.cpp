@@ -0,0 +1,573 @@
+/**
+ * Solves for straightConversion and thetaConversion by least squares against reference poses,
+ * and writes them to a param file robot_driver loads at startup.
+ *
+ * Usage: odometry_calibrate [-o odometry.yaml] [-l segment_sec] [-w meters_per_radian] [-j threads]
+ *                           [clock_log.csv poses.csv]
+ *
+ * clock_log.csv is the log robot_driver writes when ~clock_log is set. poses.csv is either
+ * "rostopic echo -p" output of an Odometry topic such as /odometry/filtered, or plain
+ * "time_sec,x,y,theta" lines from any other source like lidar scan matching. Without files it
+ * generates a drive with known conversions, noisy reference poses and a few wheel slips, and
+ * only writes the param file when -o is given.
+ *
+ * The reference is cut into segments about segment_sec long. Each segment's motion, seen from
+ * where it started, is compared against the odometry over the same time with the frames stamped
+ * the way the driver stamps them. A radian of heading error weighs as much as meters_per_radian
+ * meters of position error. Gauss-Newton over the two conversions converges in a few
+ * iterations; each iteration integrates the whole log three times and spreads the segment
+ * residuals over every core. Segments off by more than three times the RMS, like wheel slips,
+ * are dropped once and the fit is repeated.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "robot_driver/cortexClock.h"
+#include "robot_driver/frameLog.h"
+#include "robot_driver/odometryBatch.h"
+
+struct poseRecord
+{
+  double time, x, y, theta;
+};
+
+//Reference motion over a stretch of the log, and where its ends fall between frames
+struct segment
+{
+  size_t startFrame, endFrame;
+  double startFraction, endFraction;
+  double x, y, theta; //motion in the frame of the start pose
+  bool inlier;
+};
+
+//Normal equations of the two conversions
+struct normalEquations
+{
+  double jtj[3] = {0, 0, 0}; //ss, st, tt
+  double jtr[2] = {0, 0};
+  double cost = 0;
+  size_t count = 0;
+
+  void add(const normalEquations &other)
+  {
+    for (int i = 0; i < 3; i++)
+      jtj[i] += other.jtj[i];
+    for (int i = 0; i < 2; i++)
+      jtr[i] += other.jtr[i];
+    cost += other.cost;
+    count += other.count;
+  }
+};
+
+static double wrapAngle(const double angle)
+{
+  return std::remainder(angle, 2 * M_PI);
+}
+
+/**
+ * Runs work(begin, end, chunk) over [0, count) split into one contiguous chunk per thread
+ */
+template <typename function>
+static void parallelFor(const size_t count, const unsigned int threads, const function &work)
+{
+  std::vector<std::thread> workers;
+  const size_t chunk = (count + threads - 1) / threads;
+  for (unsigned int t = 0; t < threads && t * chunk < count; t++)
+    workers.emplace_back(work, t * chunk, std::min(count, (t + 1) * chunk), t);
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+/**
+ * Splits a CSV line into fields
+ */
+static std::vector<std::string> splitFields(const std::string &line)
+{
+  std::vector<std::string> fields;
+  std::stringstream stream(line);
+  std::string field;
+  while (std::getline(stream, field, ','))
+    fields.push_back(field);
+  return fields;
+}
+
+/**
+ * Reads "rostopic echo -p" output of an Odometry topic, or "time_sec,x,y,theta" lines
+ */
+static bool readPoses(const std::string &path, std::vector<poseRecord> *poses)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+    return false;
+
+  std::string line;
+  if (!std::getline(in, line))
+    return true;
+
+  if (line.compare(0, 5, "%time") != 0)
+  {
+    do
+    {
+      poseRecord pose;
+      if (std::sscanf(line.c_str(), "%lf,%lf,%lf,%lf", &pose.time, &pose.x, &pose.y, &pose.theta) == 4)
+        poses->push_back(pose);
+    } while (std::getline(in, line));
+    return true;
+  }
+
+  //Find the columns by name, the header stamp is in nanoseconds
+  const std::vector<std::string> header = splitFields(line);
+  const char *names[] = {"field.header.stamp", "field.pose.pose.position.x", "field.pose.pose.position.y",
+                         "field.pose.pose.orientation.x", "field.pose.pose.orientation.y",
+                         "field.pose.pose.orientation.z", "field.pose.pose.orientation.w"};
+  size_t columns[7];
+  for (int i = 0; i < 7; i++)
+  {
+    columns[i] = std::find(header.begin(), header.end(), names[i]) - header.begin();
+    if (columns[i] == header.size())
+    {
+      std::fprintf(stderr, "odometry_calibrate: %s has no %s column\n", path.c_str(), names[i]);
+      return false;
+    }
+  }
+
+  while (std::getline(in, line))
+  {
+    const std::vector<std::string> fields = splitFields(line);
+    if (fields.size() < header.size())
+      continue;
+
+    double values[7];
+    for (int i = 0; i < 7; i++)
+      values[i] = std::atof(fields[columns[i]].c_str());
+
+    const double qx = values[3], qy = values[4], qz = values[5], qw = values[6];
+    poses->push_back({values[0] / 1e9, values[1], values[2],
+                      std::atan2(2 * (qw * qz + qx * qy), 1 - 2 * (qy * qy + qz * qz))});
+  }
+
+  return true;
+}
+
+/**
+ * Simulates half an hour of driving with wheels 2% further apart and 1.5% larger than the
+ * defaults, with serial delays on the frames, 30Hz reference poses with 5mm and 0.3 degree
+ * noise, and a wheel slipping in place for a second every five minutes
+ */
+static diffDriveGeometry generateLogs(frameLog *log, std::vector<poseRecord> *poses)
+{
+  const diffDriveGeometry defaults;
+  diffDriveGeometry truth;
+  truth.straightConversion = defaults.straightConversion * 1.015;
+  truth.thetaConversion = defaults.thetaConversion * 1.015 / 1.02;
+
+  std::mt19937 rng(11);
+  std::exponential_distribution<double> delay(1 / 0.003);
+  std::normal_distribution<double> positionNoise(0, 0.005), headingNoise(0, 0.3 * M_PI / 180);
+
+  const double frameDt = 0.015, step = 0.001, metersPerCount = truth.straightConversion / 1000;
+  double left = 0, right = 0, x = 0, y = 0, theta = 0, nextFrame = 0, nextPose = 0;
+
+  for (double t = 0; t < 1800; t += step)
+  {
+    if (t >= nextFrame)
+    {
+      log->arrival.push_back(t + 0.002 + delay(rng));
+      log->dt.push_back(frameDt);
+      log->left.push_back(std::floor(left));
+      log->right.push_back(std::floor(right));
+      nextFrame += frameDt;
+    }
+
+    if (t >= nextPose)
+    {
+      poses->push_back({t, x + positionNoise(rng), y + positionNoise(rng), wrapAngle(theta + headingNoise(rng))});
+      nextPose += 1 / 30.0;
+    }
+
+    const double v = 0.4 + 0.2 * std::sin(0.05 * t), omega = 0.8 * std::sin(0.3 * t) + 0.3 * std::sin(0.011 * t);
+    left += (v / metersPerCount - omega / truth.thetaConversion) * step;
+    right += (v / metersPerCount + omega / truth.thetaConversion) * step;
+
+    if (std::fmod(t, 300) < 1)
+      continue;
+
+    const double half = omega * step / 2, ds = v * step;
+    const double chord = std::fabs(half) > 1e-12 ? ds * std::sin(half) / half : ds;
+    x += chord * std::cos(theta + half);
+    y += chord * std::sin(theta + half);
+    theta += 2 * half;
+  }
+
+  //Frames can't arrive out of order
+  for (size_t i = 1; i < log->size(); i++)
+    log->arrival[i] = std::max(log->arrival[i], log->arrival[i - 1]);
+
+  return truth;
+}
+
+/**
+ * Finds the frame before a time and how far the time is towards the next one
+ */
+static bool locate(const std::vector<double> &stamps, const double time, size_t *frame, double *fraction)
+{
+  if (time < stamps.front() || time >= stamps.back())
+    return false;
+
+  *frame = std::upper_bound(stamps.begin(), stamps.end(), time) - stamps.begin() - 1;
+  *fraction = (time - stamps[*frame]) / (stamps[*frame + 1] - stamps[*frame]);
+  return true;
+}
+
+/**
+ * Cuts the reference into segments of at least length seconds that moved
+ */
+static std::vector<segment> makeSegments(const std::vector<poseRecord> &poses, const std::vector<double> &stamps, const double length)
+{
+  std::vector<segment> segments;
+  size_t start = 0;
+  for (size_t end = 1; end < poses.size(); end++)
+  {
+    const poseRecord &a = poses[start], &b = poses[end];
+    if (b.time - a.time < length)
+      continue;
+
+    segment seg;
+    const double dx = b.x - a.x, dy = b.y - a.y;
+    seg.x = std::cos(a.theta) * dx + std::sin(a.theta) * dy;
+    seg.y = -std::sin(a.theta) * dx + std::cos(a.theta) * dy;
+    seg.theta = wrapAngle(b.theta - a.theta);
+    seg.inlier = true;
+
+    //Gaps in the reference and standing still say nothing about the conversions
+    const bool moved = std::hypot(seg.x, seg.y) > 0.01 || std::fabs(seg.theta) > 0.01;
+    if (b.time - a.time < 2 * length && moved &&
+        locate(stamps, a.time, &seg.startFrame, &seg.startFraction) &&
+        locate(stamps, b.time, &seg.endFrame, &seg.endFraction))
+      segments.push_back(seg);
+
+    start = end;
+  }
+  return segments;
+}
+
+/**
+ * Pose at a frame, frame 0 being the start of the trajectory
+ */
+static void poseAt(const odometryTrajectory &trajectory, const size_t frame, const double fraction,
+                   double *x, double *y, double *theta)
+{
+  const double x0 = frame > 0 ? trajectory.x[frame - 1] : 0, y0 = frame > 0 ? trajectory.y[frame - 1] : 0,
+               theta0 = frame > 0 ? trajectory.theta[frame - 1] : 0;
+
+  *x = x0 + fraction * (trajectory.x[frame] - x0);
+  *y = y0 + fraction * (trajectory.y[frame] - y0);
+  *theta = theta0 + fraction * wrapAngle(trajectory.theta[frame] - theta0);
+}
+
+/**
+ * Odometry's error against one segment
+ */
+static void segmentResidual(const odometryTrajectory &trajectory, const segment &seg, const double headingWeight, double residual[3])
+{
+  double ax, ay, atheta, bx, by, btheta;
+  poseAt(trajectory, seg.startFrame, seg.startFraction, &ax, &ay, &atheta);
+  poseAt(trajectory, seg.endFrame, seg.endFraction, &bx, &by, &btheta);
+
+  const double dx = bx - ax, dy = by - ay;
+  residual[0] = std::cos(atheta) * dx + std::sin(atheta) * dy - seg.x;
+  residual[1] = -std::sin(atheta) * dx + std::cos(atheta) * dy - seg.y;
+  residual[2] = headingWeight * wrapAngle(btheta - atheta - seg.theta);
+}
+
+/**
+ * Builds the normal equations around a geometry, with the Jacobian from forward differences
+ */
+static normalEquations linearize(const odometryBatch &batch, const std::vector<segment> &segments, const diffDriveGeometry &geometry,
+                                 const double headingWeight, const unsigned int threads)
+{
+  diffDriveGeometry perturbed[3] = {geometry, geometry, geometry};
+  const double hs = geometry.straightConversion * 1e-6, ht = geometry.thetaConversion * 1e-6;
+  perturbed[1].straightConversion += hs;
+  perturbed[2].thetaConversion += ht;
+
+  odometryTrajectory trajectories[3];
+  parallelFor(3, std::min(threads, 3u), [&](size_t begin, size_t end, unsigned int)
+  {
+    for (size_t i = begin; i < end; i++)
+      batch.integrate(perturbed[i], &trajectories[i]);
+  });
+
+  std::vector<normalEquations> partial(threads);
+  parallelFor(segments.size(), threads, [&](size_t begin, size_t end, unsigned int chunk)
+  {
+    normalEquations &equations = partial[chunk];
+    for (size_t i = begin; i < end; i++)
+    {
+      if (!segments[i].inlier)
+        continue;
+
+      double r[3], rs[3], rt[3];
+      segmentResidual(trajectories[0], segments[i], headingWeight, r);
+      segmentResidual(trajectories[1], segments[i], headingWeight, rs);
+      segmentResidual(trajectories[2], segments[i], headingWeight, rt);
+
+      for (int k = 0; k < 3; k++)
+      {
+        const double js = (rs[k] - r[k]) / hs, jt = (rt[k] - r[k]) / ht;
+        equations.jtj[0] += js * js;
+        equations.jtj[1] += js * jt;
+        equations.jtj[2] += jt * jt;
+        equations.jtr[0] += js * r[k];
+        equations.jtr[1] += jt * r[k];
+        equations.cost += r[k] * r[k];
+      }
+      equations.count++;
+    }
+  });
+
+  normalEquations total;
+  for (const normalEquations &equations : partial)
+    total.add(equations);
+  return total;
+}
+
+/**
+ * Solves the normal equations for a step. A conversion the segments don't constrain, like
+ * thetaConversion when the robot only drove straight, keeps its value.
+ * @return False if neither is constrained
+ */
+static bool solveStep(const normalEquations &equations, double *ds, double *dt, bool *straightObserved, bool *thetaObserved)
+{
+  const double det = equations.jtj[0] * equations.jtj[2] - equations.jtj[1] * equations.jtj[1];
+  *straightObserved = equations.jtj[0] > 0;
+  *thetaObserved = equations.jtj[2] > 0;
+  *ds = *dt = 0;
+
+  if (*straightObserved && *thetaObserved && det > 1e-9 * equations.jtj[0] * equations.jtj[2])
+  {
+    *ds = -(equations.jtj[2] * equations.jtr[0] - equations.jtj[1] * equations.jtr[1]) / det;
+    *dt = -(equations.jtj[0] * equations.jtr[1] - equations.jtj[1] * equations.jtr[0]) / det;
+  }
+  else if (*straightObserved && (!*thetaObserved || equations.jtj[0] >= equations.jtj[2]))
+  {
+    *thetaObserved = false;
+    *ds = -equations.jtr[0] / equations.jtj[0];
+  }
+  else if (*thetaObserved)
+  {
+    *straightObserved = false;
+    *dt = -equations.jtr[1] / equations.jtj[2];
+  }
+
+  return *straightObserved || *thetaObserved;
+}
+
+/**
+ * Gauss-Newton from a starting geometry
+ * @return The normal equations at the solution
+ */
+static normalEquations solve(const odometryBatch &batch, const std::vector<segment> &segments, diffDriveGeometry *geometry,
+                             const double headingWeight, const unsigned int threads)
+{
+  for (int iteration = 0; iteration < 20; iteration++)
+  {
+    const normalEquations equations = linearize(batch, segments, *geometry, headingWeight, threads);
+
+    double ds, dt;
+    bool straightObserved, thetaObserved;
+    if (equations.count < 2 || !solveStep(equations, &ds, &dt, &straightObserved, &thetaObserved))
+      break;
+
+    geometry->straightConversion += ds;
+    geometry->thetaConversion += dt;
+
+    if (std::fabs(ds) < 1e-10 * geometry->straightConversion && std::fabs(dt) < 1e-10 * geometry->thetaConversion)
+      break;
+  }
+  return linearize(batch, segments, *geometry, headingWeight, threads);
+}
+
+static double rms(const normalEquations &equations)
+{
+  return equations.count > 0 ? std::sqrt(equations.cost / equations.count) : NAN;
+}
+
+/**
+ * Marks segments off by more than some multiple of the RMS as outliers
+ * @return Number of outliers
+ */
+static size_t rejectOutliers(const odometryBatch &batch, std::vector<segment> *segments, const diffDriveGeometry &geometry,
+                             const double headingWeight, const double limit)
+{
+  odometryTrajectory trajectory;
+  batch.integrate(geometry, &trajectory);
+
+  size_t outliers = 0;
+  for (segment &seg : *segments)
+  {
+    double r[3];
+    segmentResidual(trajectory, seg, headingWeight, r);
+    seg.inlier = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]) <= limit;
+    outliers += !seg.inlier;
+  }
+  return outliers;
+}
+
+static bool writeParams(const std::string &path, const diffDriveGeometry &geometry, const std::string &source)
+{
+  FILE *out = std::fopen(path.c_str(), "w");
+  if (out == nullptr)
+    return false;
+
+  std::fprintf(out, "# Written by odometry_calibrate from %s\n", source.c_str());
+  std::fprintf(out, "straight_conversion: %.9f\n", geometry.straightConversion);
+  std::fprintf(out, "theta_conversion: %.9g\n", geometry.thetaConversion);
+  return std::fclose(out) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  std::string output = "odometry.yaml";
+  bool outputGiven = false;
+  double segmentLength = 1.0, headingWeight = 1.0;
+  unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:l:w:j:")) != -1)
+  {
+    bool ok = true;
+    switch (opt)
+    {
+      case 'o':
+        output = optarg;
+        outputGiven = true;
+        break;
+      case 'l':
+        ok = std::sscanf(optarg, "%lf", &segmentLength) == 1 && segmentLength > 0;
+        break;
+      case 'w':
+        ok = std::sscanf(optarg, "%lf", &headingWeight) == 1 && headingWeight >= 0;
+        break;
+      case 'j':
+        ok = std::sscanf(optarg, "%u", &threads) == 1 && threads > 0;
+        break;
+      default:
+        ok = false;
+    }
+
+    if (!ok || (argc - optind != 0 && argc - optind != 2))
+    {
+      std::fprintf(stderr, "usage: odometry_calibrate [-o odometry.yaml] [-l segment_sec] [-w meters_per_radian] [-j threads] "
+                           "[clock_log.csv poses.csv]\n");
+      return 1;
+    }
+  }
+
+  frameLog log;
+  std::vector<poseRecord> poses;
+  std::string source = "generated logs";
+
+  if (optind < argc)
+  {
+    source = std::string(argv[optind]) + " and " + argv[optind + 1];
+    if (!readFrameLog(argv[optind], &log))
+    {
+      std::fprintf(stderr, "odometry_calibrate: can't read %s\n", argv[optind]);
+      return 1;
+    }
+    if (!readPoses(argv[optind + 1], &poses))
+    {
+      std::fprintf(stderr, "odometry_calibrate: can't read %s\n", argv[optind + 1]);
+      return 1;
+    }
+  }
+  else
+  {
+    const diffDriveGeometry truth = generateLogs(&log, &poses);
+    std::printf("generated with straight %.9f theta %.9g\n", truth.straightConversion, truth.thetaConversion);
+  }
+
+  if (log.size() < 2 || poses.size() < 2)
+  {
+    std::fprintf(stderr, "odometry_calibrate: need at least two frames and two poses\n");
+    return 1;
+  }
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  //Stamp frames the way the driver does
+  cortexClock clock;
+  std::vector<double> stamps;
+  for (size_t i = 0; i < log.size(); i++)
+    stamps.push_back(clock.update(log.arrival[i], log.dt[i]));
+
+  odometryBatch batch;
+  batch.load(log.left.data(), log.right.data(), log.dt.data(), log.size());
+
+  std::vector<segment> segments = makeSegments(poses, stamps, segmentLength);
+  if (segments.size() < 2)
+  {
+    std::fprintf(stderr, "odometry_calibrate: the poses overlap the frames in fewer than two moving segments\n");
+    return 1;
+  }
+
+  diffDriveGeometry geometry;
+  const double initialRms = rms(linearize(batch, segments, geometry, headingWeight, threads));
+
+  normalEquations equations = solve(batch, segments, &geometry, headingWeight, threads);
+  const size_t outliers = rejectOutliers(batch, &segments, geometry, headingWeight, 3 * rms(equations));
+  if (outliers > 0)
+    equations = solve(batch, segments, &geometry, headingWeight, threads);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  //Standard errors from the residual variance and the inverse of J'J
+  double ds, dt;
+  bool straightObserved, thetaObserved;
+  solveStep(equations, &ds, &dt, &straightObserved, &thetaObserved);
+
+  const double variance = equations.cost / std::max<double>(1, 3 * equations.count - 2);
+  const double det = equations.jtj[0] * equations.jtj[2] - equations.jtj[1] * equations.jtj[1];
+  const bool both = straightObserved && thetaObserved;
+  const double straightError = std::sqrt(variance * (both ? equations.jtj[2] / det : 1 / equations.jtj[0])),
+               thetaError = std::sqrt(variance * (both ? equations.jtj[0] / det : 1 / equations.jtj[2]));
+
+  std::printf("%zu frames, %zu poses, %zu segments (%zu outliers), %u threads, %.3f s\n",
+              log.size(), poses.size(), segments.size(), outliers, threads, seconds);
+  std::printf("segment RMS %.4f with the defaults, %.4f calibrated\n", initialRms, rms(equations));
+
+  if (straightObserved)
+    std::printf("straight_conversion: %.9f +- %.2g\n", geometry.straightConversion, straightError);
+  else
+    std::printf("straight_conversion: %.9f, the robot didn't drive enough to tell\n", geometry.straightConversion);
+
+  if (thetaObserved)
+    std::printf("theta_conversion: %.9g +- %.2g\n", geometry.thetaConversion, thetaError);
+  else
+    std::printf("theta_conversion: %.9g, the robot didn't turn enough to tell\n", geometry.thetaConversion);
+
+  //Conversions fitted to generated logs would only overwrite real ones, unless asked for
+  if (optind >= argc && !outputGiven)
+    return 0;
+
+  if (!writeParams(output, geometry, source))
+  {
+    std::fprintf(stderr, "odometry_calibrate: can't write %s\n", output.c_str());
+    return 1;
+  }
+  std::printf("wrote %s\n", output.c_str());
+  return 0;
+}
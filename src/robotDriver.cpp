@@ -0,0 +1,231 @@
+#include <chrono>
+#include <sys/stat.h>
+#include <boost/make_shared.hpp>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <nav_msgs/Odometry.h>
+#include <sensor_msgs/Imu.h>
+#include <tf/transform_datatypes.h>
+
+#include "robot_driver/robotDriver.h"
+
+namespace
+{
+  nav_msgs::OdometryPtr newOdometry()
+  {
+    nav_msgs::OdometryPtr odom = boost::make_shared<nav_msgs::Odometry>();
+    odom->header.frame_id = "odom";
+    odom->child_frame_id = "base_link";
+    odom->pose.pose.orientation = tf::createQuaternionMsgFromYaw(0);
+    return odom;
+  }
+
+  sensor_msgs::ImuPtr newImu()
+  {
+    sensor_msgs::ImuPtr imu = boost::make_shared<sensor_msgs::Imu>();
+    imu->header.frame_id = "base_link";
+    return imu;
+  }
+}
+
+robotDriver::robotDriver(ros::NodeHandle &n)
+{
+  std::string port;
+  int baud_rate;
+  imuSamplerConfig imuConfig;
+  diffDriveGeometry geometry;
+  std::string replayOutput;
+
+  n.getParam("/robot_driver/port", port);
+  n.getParam("/robot_driver/baud_rate", baud_rate);
+  n.getParam("/robot_driver/imu_spi", imuConfig.spiBackend);
+  n.getParam("/robot_driver/imu_fifo", imuConfig.useFifo);
+  n.getParam("/robot_driver/imu_drdy_chip", imuConfig.dataReadyChip);
+  n.getParam("/robot_driver/imu_drdy_line", imuConfig.dataReadyLine);
+  n.getParam("/robot_driver/gyro_rate_density", imuConfig.noise.yawRateDensity);
+  n.getParam("/robot_driver/gyro_bias_variance", imuConfig.noise.yawBiasVariance);
+  n.getParam("/robot_driver/acc_variance", imuConfig.noise.accVariance);
+  n.getParam("/robot_driver/imu_rate", imuRate_);
+  n.getParam("/robot_driver/imu_calibration_file", imuConfig.calibrationFile);
+  n.getParam("/robot_driver/imu_warm_start", imuConfig.warmStart);
+  n.getParam("/robot_driver/straight_conversion", geometry.straightConversion);
+  n.getParam("/robot_driver/theta_conversion", geometry.thetaConversion);
+  n.getParam("/robot_driver/count_variance", geometry.countVariancePerCount);
+  n.getParam("/robot_driver/replay_output", replayOutput);
+
+  //A flight record in place of the port is replayed, IMU samples included
+  struct stat portInfo;
+  imuConfig.replay = stat(port.c_str(), &portInfo) == 0 && S_ISREG(portInfo.st_mode);
+
+  ROS_INFO("Running with port: %s and baud rate: %d", port.c_str(), baud_rate);
+  ROS_INFO("Odometry: %f mm per count, %f rad per count, track width %f m",
+           geometry.straightConversion, geometry.thetaConversion, geometry.trackWidth());
+
+  filterFix_ = n.advertise<geometry_msgs::PoseWithCovarianceStamped>("set_pose", 10);
+
+  robot_.reset(new robotPOS(port, baud_rate, io_, imuConfig, geometry));
+
+  odomPub_ = n.advertise<nav_msgs::Odometry>("robot_publisher/odom0", 1000);
+  imuPub_ = n.advertise<sensor_msgs::Imu>("robot_publisher/imu0", 1000);
+  frameImuPub_ = n.advertise<sensor_msgs::Imu>("robot_publisher/imu_frame", 1000);
+
+  odomPub_.publish(newOdometry());
+  imuPub_.publish(newImu());
+
+  if (robot_->isReplaying() && !replayOutput.empty())
+  {
+    replayLog_.open(replayOutput.c_str());
+    replayLog_.precision(17);
+    if (!replayLog_)
+      ROS_WARN("robot_driver: can't open replay output %s", replayOutput.c_str());
+  }
+
+  imuThread_ = std::thread(&robotDriver::runImu, this);
+  rxThread_ = std::thread(&robotDriver::runRx, this);
+}
+
+robotDriver::~robotDriver()
+{
+  stop();
+}
+
+/**
+* Stops the threads. Safe to call more than once.
+*/
+void robotDriver::stop()
+{
+  //The RX thread may be waiting for a read that never completes
+  running_ = false;
+  io_.stop();
+
+  if (rxThread_.joinable())
+    rxThread_.join();
+  if (imuThread_.joinable())
+    imuThread_.join();
+}
+
+/**
+* RX thread main loop: waits for serial reads and publishes every frame they held
+*/
+void robotDriver::runRx()
+{
+  //Full speed replays must not sit waiting between records
+  const std::chrono::microseconds replayWait(robot_->getReplayRate() <= 0 ? 0 : 1000);
+  const std::chrono::steady_clock::time_point replayStart = std::chrono::steady_clock::now();
+  unsigned long frames = 0;
+
+  //Published messages belong to their subscribers, each frame is filled into a new one
+  nav_msgs::OdometryPtr odom = newOdometry();
+  sensor_msgs::ImuPtr frameImu = newImu();
+
+  try
+  {
+    bool firstPub = true;
+
+    while (running_ && ros::ok() && !robot_->isReplayDone() && !robot_->txFailed())
+    {
+      //A replay paces itself in poll
+      if (!robot_->isReplaying())
+        io_.run_one();
+      else if (replayWait.count() > 0)
+        std::this_thread::sleep_for(replayWait);
+
+      while (robot_->poll(odom.get()))
+      {
+        odomPub_.publish(odom);
+        robot_->odomPublished();
+        frames++;
+
+        if (robot_->popFrameImu(frameImu.get()))
+        {
+          frameImuPub_.publish(frameImu);
+          frameImu = newImu();
+        }
+
+        if (replayLog_.is_open())
+          replayLog_ << odom->header.stamp.toNSec() << ',' << odom->pose.pose.position.x << ','
+                     << odom->pose.pose.position.y << ',' << tf::getYaw(odom->pose.pose.orientation) << ','
+                     << odom->twist.twist.linear.x << ',' << odom->twist.twist.angular.z << '\n';
+
+        odom = newOdometry();
+      }
+
+      if (firstPub)
+      {
+        publishInitialPose();
+        firstPub = false;
+      }
+    }
+  }
+  catch (const boost::system::system_error &ex)
+  {
+    fail(std::string("reading from the cortex failed: ") + ex.what());
+  }
+
+  if (robot_->txFailed() && !failed_)
+    fail("writing to the cortex failed: " + robot_->txError());
+
+  if (robot_->isReplayDone())
+  {
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+    ROS_INFO("robot_driver: replayed %lu frames in %f s, %f frames per second", frames, seconds, frames / seconds);
+  }
+
+  done_ = true;
+}
+
+/**
+* Stops the driver after the link failed and reports why, from the RX thread
+* @param reason What failed
+*/
+void robotDriver::fail(const std::string &reason)
+{
+  ROS_ERROR("robot_driver: %s", reason.c_str());
+  failure_ = reason;
+  failed_ = true;
+
+  //Nothing more reaches the cortex or the subscribers, say so on /diagnostics once the rest is quiet
+  running_ = false;
+  robot_->stop();
+  robot_->reportFailure(reason);
+}
+
+/**
+* IMU thread main loop: publishes samples on their own schedule so a stalled serial link can't starve them
+*/
+void robotDriver::runImu()
+{
+  ros::Rate rate(imuRate_);
+  sensor_msgs::ImuPtr imu = newImu();
+
+  while (running_ && ros::ok())
+  {
+    while (robot_->popImu(imu.get()))
+    {
+      imuPub_.publish(imu);
+      imu = newImu();
+    }
+
+    rate.sleep();
+  }
+}
+
+/**
+* Tells the EKF to start from the origin
+*/
+void robotDriver::publishInitialPose()
+{
+  geometry_msgs::PoseWithCovarianceStampedPtr msg = boost::make_shared<geometry_msgs::PoseWithCovarianceStamped>();
+  msg->header.stamp = ros::Time::now();
+  msg->pose.pose.orientation.w = 1;
+  const boost::array<float, 36> cov =
+    {{
+      1e-6, 0,    0,    0,    0,    0,
+      0,    1e-6, 0,    0,    0,    0,
+      0,    0,    1e-6, 0,    0,    0,
+      0,    0,    0,    1e-6, 0,    0,
+      0,    0,    0,    0,    1e-6, 0,
+      0,    0,    0,    0,    0,    1e-6
+    }};
+  msg->pose.covariance = cov;
+  filterFix_.publish(msg);
+}
@@ -0,0 +1,85 @@
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "robot_driver/robotDriver.h"
+
+/**
+ * robot_driver as a nodelet. Load it into the same manager as the EKF and the lidar merger and
+ * they get its odometry and IMU messages without serialisation. A failed link stops the driver
+ * and is reported, the manager and the other nodelets in it keep running.
+ */
+class robotDriverNodelet : public nodelet::Nodelet
+{
+  public:
+    ~robotDriverNodelet()
+    {
+      if (startThread_.joinable())
+        startThread_.join();
+
+      watchTimer_.stop();
+      if (driver_)
+        driver_->stop();
+    }
+
+  private:
+    std::unique_ptr<robotDriver> driver_;
+    std::thread startThread_;
+    ros::WallTimer watchTimer_;
+
+    //How often to check whether the driver stopped
+    static constexpr double watchPeriod = 0.5;
+
+    /**
+     * Starts the driver on its own thread, IMU initialization and calibration take seconds and
+     * must not hold up the manager
+     */
+    virtual void onInit()
+    {
+      startThread_ = std::thread(&robotDriverNodelet::start, this);
+    }
+
+    /**
+     * Creates the driver, then watches it
+     */
+    void start()
+    {
+      try
+      {
+        driver_.reset(new robotDriver(getNodeHandle()));
+      }
+      catch (const boost::system::system_error &ex)
+      {
+        NODELET_ERROR("robot_driver: Error instantiating robot object. Are you sure you have the correct port and baud rate? Error was: %s", ex.what());
+        return;
+      }
+      catch (const std::invalid_argument &ex)
+      {
+        NODELET_ERROR("robot_driver: Bad parameter: %s", ex.what());
+        return;
+      }
+
+      watchTimer_ = getNodeHandle().createWallTimer(ros::WallDuration(watchPeriod), &robotDriverNodelet::watch, this);
+    }
+
+    /**
+     * Reports a driver that stopped, because a replay is done or the link failed
+     */
+    void watch(const ros::WallTimerEvent &event)
+    {
+      if (!driver_->isDone())
+        return;
+
+      watchTimer_.stop();
+      driver_->stop();
+
+      if (driver_->failed())
+        NODELET_ERROR("robot_driver: driver stopped: %s", driver_->failure().c_str());
+      else
+        NODELET_INFO("robot_driver: driver finished");
+    }
+};
+
+PLUGINLIB_EXPORT_CLASS(robotDriverNodelet, nodelet::Nodelet)
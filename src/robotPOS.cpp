@@ -33,214 +33,342 @@
 *********************************************************************/
 
 #include <cmath>
+#include <cerrno>
 #include <algorithm>
+#include <unistd.h>
 #include <geometry_msgs/Quaternion.h>
 #include <std_msgs/Empty.h>
-#include <std_msgs/String.h>
+#include <std_msgs/UInt8MultiArray.h>
 #include <sensor_msgs/point_cloud_conversion.h>
 #include <iostream>
+#include <stdexcept>
 #include <tf/transform_broadcaster.h>
 #include <ros/ros.h>
 #include <tf/transform_datatypes.h>
 #include <tf/tf.h>
 #include <tf/transform_listener.h>
+#include <boost/bind.hpp>
 
 #include "robot_driver/robotPOS.h"
 
-constexpr float gravity = 9.80665;
+//std::min takes it by reference, so it needs storage
+const int robotPOS::maxProtocolVersion;
 
-robotPOS::robotPOS(const std::string &port, const uint32_t baud_rate, boost::asio::io_service &io, const int csChannel, const long speed):
+robotPOS::robotPOS(const std::string &port, const uint32_t baud_rate, boost::asio::io_service &io, const imuSamplerConfig &imuConfig,
+                   const diffDriveGeometry &geometry):
 port_(port),
 baud_rate_(baud_rate),
-serial_(io, port_),
-imu_(csChannel, speed)
+imu_(imuConfig),
+rxIo_(io),
+serial_(io),
+txPort_(txIo_),
+replaying_(imuConfig.replay),
+receiver_(geometry, imu_.feed(), latency_),
+spinner_(1, &callbacks_)
 {
-  serial_.set_option(boost::asio::serial_port_base::baud_rate(baud_rate_));
+  n.setCallbackQueue(&callbacks_);
 
-  cortexPub = n.advertise<std_msgs::String>("robotPOS/cortexPub", 10);
-  ekfSub = n.subscribe<nav_msgs::Odometry>("odometry/filtered", 10, &robotPOS::ekf_callback, this);
+  //A flight record in place of the port plays back what the robot sent instead of talking to it
+  if (replaying_)
+  {
+    int session = -1;
+    n.getParam("/robot_driver/replay_rate", replayRate_);
+    n.getParam("/robot_driver/replay_session", session);
+
+    if (!replay_.open(port_))
+      throw std::invalid_argument(port_ + " is not a flight record");
+    if (!replay_.selectSession(session))
+      throw std::invalid_argument(port_ + " has no session " + std::to_string(session));
+
+    ROS_INFO("robotPOS: replaying session %d of %s at %s", session, port_.c_str(),
+             replayRate_ > 0 ? (std::to_string(replayRate_) + "x recorded speed").c_str() : "full speed");
+  }
+  else
+  {
+    serial_.open(port_);
+    serial_.set_option(boost::asio::serial_port_base::baud_rate(baud_rate_));
+
+    //Writes go through their own descriptor so the TX thread never touches the RX thread's port object
+    const int txFd = ::dup(serial_.native_handle());
+    if (txFd < 0)
+      throw boost::system::system_error(errno, boost::system::system_category(), "dup");
+    txPort_.assign(txFd);
+  }
+
+  cortexPub = n.advertise<std_msgs::UInt8MultiArray>("robotPOS/cortexPub", 10);
+  ekfSub = n.subscribe<nav_msgs::Odometry>("odometry/filtered", 1, &robotPOS::ekf_callback, this);
   mpcSub = n.subscribe<sensor_msgs::PointCloud>("mpc/nextObjects", 10, &robotPOS::mpc_callback, this);
   lidarRPMSub = n.subscribe<std_msgs::UInt16>("lidar/rpm", 10, &robotPOS::lidarRPM_callback, this);
 
-  // Init imu
-  ROS_INFO("robotPOS: IMU INIT\n");
+  //Size the raw frame message for the longest frame up front so it never reallocates
+  size_t maxFrameLength = 0;
+  for (const uint8_t type : msgTypes)
+  {
+    receiver_.setPayloadLength(type, getMsgLengthForType(type));
+    maxFrameLength = std::max(maxFrameLength, size_t(getMsgLengthForType(type)) + 2);
+  }
+  cortexOut_.data.reserve(maxFrameLength);
+  txBuffers_.reserve(txQueueSize);
 
-  imu_.init(1, BITS_DLPF_CFG_20HZ);
+  bool fuseYaw = true;
+  n.getParam("/robot_driver/imu_fuse_yaw", fuseYaw);
+  receiver_.setFuseYaw(fuseYaw);
 
-  usleep(10000);
+  std::string clockLog;
+  if (n.getParam("/robot_driver/clock_log", clockLog) && !clockLog.empty())
+  {
+    clockLog_.open(clockLog.c_str());
+    if (!clockLog_)
+      ROS_WARN("robotPOS: can't open clock log %s", clockLog.c_str());
+  }
 
-  ROS_INFO("robotPOS: gyro scale = %d", imu_.set_gyro_scale(BITS_FS_500DPS));
+  std::string flightRecord;
+  int flightRecordMb = 64;
+  n.getParam("/robot_driver/flight_record_mb", flightRecordMb);
+  if (!replaying_ && n.getParam("/robot_driver/flight_record", flightRecord) && !flightRecord.empty())
+  {
+    if (recorder_.open(flightRecord, size_t(flightRecordMb) << 20))
+      imu_.setRecorder(&recorder_);
+    else
+      ROS_WARN("robotPOS: can't open flight record %s", flightRecord.c_str());
+  }
 
-  usleep(50000);
+  //Offer the checksummed framing, a replay follows whatever the recorded cortex answered
+  n.getParam("/robot_driver/protocol_version", requestedVersion_);
+  requestedVersion_ = std::max(1, std::min(requestedVersion_, maxProtocolVersion));
+  if (requestedVersion_ > 1 && !replaying_)
+    helloTimer_ = n.createTimer(ros::Duration(helloPeriod), &robotPOS::sendHello, this);
 
-  ROS_INFO("robotPOS: accel scale = %d", imu_.set_acc_scale(BITS_FS_2G));
+  //Pace ekf poses to what the cortex takes, a replay has no cortex to take them
+  n.getParam("/robot_driver/ekf_rate", ekfRate_);
+  n.getParam("/robot_driver/field_static", fieldStatic_);
+  if (ekfRate_ <= 0)
+  {
+    ROS_WARN("robotPOS: ekf_rate %g isn't positive, sending %g poses per second", ekfRate_, defaultEkfRate);
+    ekfRate_ = defaultEkfRate;
+  }
+  if (!replaying_)
+    ekfTimer_ = n.createTimer(ros::Duration(1.0 / ekfRate_), &robotPOS::forwardPose, this);
 
-  usleep(10000);
-  usleep(50000);
+  diagnostics_.status.resize(recorder_.isOpen() ? 4 : 3);
+  diagnosticsPub_ = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+  diagnosticsTimer_ = n.createTimer(ros::Duration(diagnosticsPeriod), &robotPOS::publishDiagnostics, this);
 
-  //Sample imu to get bias
-  ROS_INFO("robotPOS: IMU CALIBRATING");
+  //Until the planner sends objects the cortex is told there are none
+  mpcMessage empty;
+  encodeMpcMessage(nullptr, 0, 0, 0, &empty);
+  mpcOut_.store(empty);
 
-  constexpr int imuSampleCount = 1000;
-  for (int i = 0; i < imuSampleCount; i++)
-  {
-    channel0Bias += imu_.read_acc(0);
-    channel1Bias += imu_.read_acc(1);
-    channel2Bias += imu_.read_acc(2);
+  imu_.start();
 
-    channel2RotBias += imu_.read_rot(2);
+  if (!replaying_)
+  {
+    txWork_.reset(new boost::asio::io_service::work(txIo_));
+    txThread_ = std::thread(&robotPOS::runTx, this);
+    startRead();
   }
 
-  channel0Bias /= imuSampleCount;
-  channel1Bias /= imuSampleCount;
-  channel2Bias /= imuSampleCount;
+  spinner_.start();
+}
 
-  channel2RotBias /= imuSampleCount;
+robotPOS::~robotPOS()
+{
+  stop();
+}
 
-  ROS_INFO("robotPOS: Channel 0 Bias: %lf", channel0Bias);
-  ROS_INFO("robotPOS: Channel 1 Bias: %lf", channel1Bias);
-  ROS_INFO("robotPOS: Channel 2 Bias: %lf", channel2Bias);
+/**
+* Stops the callbacks, the TX thread and the IMU sampling. Safe to call more than once.
+*/
+void robotPOS::stop()
+{
+  //Callbacks send, so they stop before the thread that writes
+  spinner_.stop();
 
-  ROS_INFO("robotPOS: Channel 2 Rot Bias: %lf", channel2RotBias);
+  txWork_.reset();
+  txIo_.stop();
+  if (txThread_.joinable())
+    txThread_.join();
 
-  ROS_INFO("robotPOS: IMU CALIBRATION DONE");
-  ROS_INFO("robotPOS: IMU INIT DONE");
+  imu_.stop();
 }
 
 /**
-* Polls UART and sets its inputs to the latest data
+* Publishes the cortex link as failed on /diagnostics
+* @param reason What failed
+*/
+void robotPOS::reportFailure(const std::string &reason)
+{
+  failure_ = reason;
+  publishDiagnostics(ros::TimerEvent());
+}
+
+/**
+* Parses received UART bytes and sets its inputs to the latest data. Never blocks; call it
+* until it returns false after running the io_service.
 * @param odom Odometry data
-* @param imu  IMU data
 */
-//true if odom and imu were filled
+//true if odom was filled
+bool robotPOS::poll(nav_msgs::Odometry *odom)
+{
+  //A replay moves the next recorded read in once the last one is parsed, one read per call
+  if (replaying_ && rxOffset_ == rxLength_)
+    readReplay();
 
-constexpr int msgLength = 27; //Length of output msg must be constant
-std::vector<int8_t> out_mpc(msgLength); //Vector holding output bytes
+  while (rxOffset_ < rxLength_)
+  {
+    const cortexFrame *frame;
+    rxOffset_ += receiver_.parse(&rxBuffer_[rxOffset_], rxLength_ - rxOffset_, rxArrival_, &frame);
 
-bool robotPOS::poll(nav_msgs::Odometry *odom, sensor_msgs::Imu *imu)
-{
-  boost::array<uint8_t, 3> flagHolders; //0 = start byte, 1 = msg type, 2 = msg count
+    if (frame != nullptr && handleFrame(*frame, odom))
+      return true;
+  }
 
-  constexpr int start_index = 0, msg_type_index = 1, msg_count_index = 2;
+  //Everything received so far is parsed, ask for more
+  if (!replaying_ && !readPending_)
+    startRead();
 
-  // Load start byte
-  do
-  {
-    boost::asio::read(serial_, boost::asio::buffer(&flagHolders[start_index], 1));
-  } while (flagHolders[start_index] != 0xFA);
+  return false;
+}
+
+/**
+* Starts an asynchronous read into the receive buffer
+*/
+void robotPOS::startRead()
+{
+  readPending_ = true;
+  serial_.async_read_some(boost::asio::buffer(rxBuffer_),
+    boost::bind(&robotPOS::readHandler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
 
-  // Load rest of header
-  boost::asio::read(serial_, boost::asio::buffer(&flagHolders[msg_type_index], 2));
+/**
+* Called by the io_service when a read completes
+* @param error             Read error
+* @param bytesTransferred  Number of bytes read
+*/
+void robotPOS::readHandler(const boost::system::error_code &error, const size_t bytesTransferred)
+{
+  readPending_ = false;
 
-  //ROS_INFO("Header %d  %d  %d",flagHolders[0],flagHolders[1],flagHolders[2]);
-  // Verify msg count
- /* if (!verifyMsgHeader(flagHolders[msg_type_index], flagHolders[msg_count_index]))
+  if (error)
   {
-    //ROS_INFO("robotPOS: poll: Message count invalid (%d) for type %d.", unsigned(flagHolders[msg_count_index]), unsigned(flagHolders[msg_type_index]));
+    if (error != boost::asio::error::operation_aborted)
+      throw boost::system::system_error(error);
+    return;
   }
-*/
 
-  // Load msg
-  //Union for converting 4 bytes of a long from RobotC into a int32_t
-  union long2Bytes { int32_t l; uint8_t b[4]; };
+  rxStamp_ = ros::Time::now();
+  rxArrival_ = monotonicClock::now();
+  rxOffset_ = 0;
+  rxLength_ = bytesTransferred;
 
-  //Init data vector with size of message
-  const int msglen = unsigned(getMsgLengthForType(flagHolders[msg_type_index]));
-  std::vector<uint8_t> msgData(msglen);
+  recorder_.recordSerial(&rxBuffer_[0], bytesTransferred, steadyNs(rxArrival_), rxStamp_.toNSec());
+}
 
-  boost::asio::read(serial_, boost::asio::buffer(msgData, msglen));
+/**
+* Moves the next recorded read into the receive buffer once it is due, first handing the IMU the
+* samples recorded before it
+* @return True if the buffer was filled
+*/
+bool robotPOS::readReplay()
+{
+  rxOffset_ = rxLength_ = 0;
 
-  //Publish raw bytes for the record
-  std_msgs::String cortexOut;
-  std::stringstream ss;
-  ss << "cortex data in: ";
-  for (uint8_t data : msgData)
+  while (replayPending_ || replay_.next(&replayRecord_))
   {
-    ss << unsigned(data) << ",";
-  	//ROS_INFO("data: %d", unsigned(data));
+    replayPending_ = true;
+    const flightRecordView &record = replayRecord_;
+    const monotonicClock::time_point now = monotonicClock::now();
+
+    if (replayStartNs_ == 0)
+    {
+      replayStartNs_ = record.monotonicNs;
+      replayStart_ = now;
+    }
+
+    //Keep to the recorded pace, the record stays pending until it is due
+    if (replayRate_ > 0 && record.monotonicNs > replayStartNs_ &&
+        now < replayStart_ + std::chrono::nanoseconds(int64_t((record.monotonicNs - replayStartNs_) / replayRate_)))
+      return false;
+
+    replayPending_ = false;
+
+    mpu6000_sample data;
+    imuBiasModel bias;
+    if (decodeImuRecord(record, &data))
+    {
+      imuSample sample;
+      sample.stamp.fromNSec(record.rosNs);
+      sample.data = data;
+      imu_.replaySample(sample);
+    }
+    else if (decodeImuBiasRecord(record, &bias))
+    {
+      imu_.replayBias(bias);
+    }
+    else if (record.type == flightSerial && rxLength_ + record.length <= rxBufferSize)
+    {
+      //The recorded arrival time makes every frame's stamp, and so the whole replay, repeatable
+      if (rxLength_ == 0)
+      {
+        rxStamp_.fromNSec(record.rosNs);
+        rxArrival_ = now;
+      }
+
+      std::copy(record.data, record.data + record.length, rxBuffer_.begin() + rxLength_);
+      rxLength_ += record.length;
+
+      if (!(record.flags & flightSerialContinued))
+        return true;
+    }
   }
-  ss >> cortexOut.data;
-  cortexPub.publish(cortexOut);
 
-  static int32_t lastRightQuad = 0, lastLeftQuad = 0;
+  replayDone_ = true;
+  return rxLength_ > 0;
+}
 
-  static float xPosGlobal = 0, yPosGlobal = 0, thetaGlobal = 0;//ROBOT_STARTING_THETA;
+/**
+* Handles one frame from the cortex
+* @param frame Received frame
+* @param odom  Odometry data
+* @return      True if odom was filled
+*/
+bool robotPOS::handleFrame(const cortexFrame &frame, nav_msgs::Odometry *odom)
+{
+  //Publish raw bytes for the record, only when someone listens so the normal path doesn't allocate
+  if (cortexPub.getNumSubscribers() > 0)
+  {
+    cortexOut_.data.resize(frame.length + 2);
+    cortexOut_.data[0] = frame.type;
+    cortexOut_.data[1] = frame.count;
+    std::copy(frame.payload.begin(), frame.payload.begin() + frame.length, cortexOut_.data.begin() + 2);
+    cortexPub.publish(cortexOut_);
+  }
 
   // Parse msg
-  switch (flagHolders[1])
+  switch (frame.type)
   {
     //STD msg means the robot is telling us its current sensor values
     case std_msg_type:
     {
-      long2Bytes quads;
-
-      //Read in left quads from 4 byte union
-      for (int i = 0; i < 4; i++)
-        quads.b[i] = msgData[i + 1];
-      int32_t leftQuad = quads.l;
-
-      //Read in right quads from 4 byte union
-      for (int i = 0; i < 4; i++)
-        quads.b[i] = msgData[i + 5];
-      int32_t rightQuad = quads.l;
-     // ROS_INFO("Robot driver right: %ld  left: %ld",rightQuad,leftQuad);
-
-      //Read in dt
-      int8_t dt = msgData[9];
-      if (dt == 0)
-      	dt = 15;
-
-      //Assume we are not moving if we tipped backwards
-      if ((imu_.read_acc(2) - channel2Bias) * gravity < 0.95 * gravity)
-      {
-        leftQuad = lastLeftQuad;
-        rightQuad = lastRightQuad;
-        ROS_INFO("robot_driver: tipped too far!");
-      }
-
-      //Twist
-      const int32_t rightDelta = (rightQuad - lastRightQuad),
-      leftDelta = (leftQuad - lastLeftQuad);
+      cortexStdFrame values;
+      receiver_.handleStd(frame, rxStamp_.toSec(), &values);
+      odom->header.stamp.fromSec(values.stamp);
+      frameImuStamp_ = odom->header.stamp;
 
-      lastRightQuad = rightQuad;
-      lastLeftQuad = leftQuad;
+      if (clockLog_.is_open())
+        clockLog_ << std::fixed << rxStamp_.toSec() << ',' << int(values.dt) << ',' << values.leftQuad << ',' << values.rightQuad << '\n';
 
-      const float avg = (rightDelta + leftDelta) / 2.0,
-                  dif = (rightDelta - leftDelta) / 2.0;
+      if (values.tipped)
+        ROS_INFO("robot_driver: tipped too far!");
 
-      const float dist = (avg * straightConversion) / 1000.0, //robots coordinate frame
-      dtheta = dif * thetaConversion;
-      
       //Print if left quad moved a lot in one timestep
-			if (leftDelta > 100 || leftDelta < -100)
-				ROS_INFO("serious issues %d",leftDelta);
-				
-      const float theta = thetaGlobal + dtheta;
-
-      const float dx = cos(theta) * dist, //world coordinate frame
-                  dy = sin(theta) * dist;
-
-      const float v = 1000* dist / dt,
-                  vtheta = 1000 * dtheta / dt;
-
-      odom->twist.twist.linear.x = v;
-      odom->twist.twist.linear.y = 0;
-      odom->twist.twist.linear.z = 0;
-      odom->twist.twist.angular.x = 0;
-      odom->twist.twist.angular.y = 0;
-      thetaGlobal += dtheta;
-      odom->twist.twist.angular.z = vtheta;
-      odom->twist.covariance = ODOM_TWIST_COV_MAT;
-
-      //Pose
-      xPosGlobal += dx;
-      yPosGlobal += dy;
-      odom->pose.pose.position.x = xPosGlobal;
-      odom->pose.pose.position.y = yPosGlobal;
-      odom->pose.pose.position.z = 0;
-      odom->pose.pose.orientation = tf::createQuaternionMsgFromYaw(thetaGlobal);
-      odom->pose.covariance = ODOM_POSE_COV_MAT;
+      const diffDriveOdometry &odometry = receiver_.odometry();
+      if (odometry.leftDelta() > 100 || odometry.leftDelta() < -100)
+        ROS_INFO("serious issues %d", odometry.leftDelta());
+
+      fillOdometry(odom);
 
+      latency_.mark(latencyMonitor::odometryDone);
       break;
     }
 
@@ -251,17 +379,45 @@ bool robotPOS::poll(nav_msgs::Odometry *odom, sensor_msgs::Imu *imu)
 
       //Set flag
       didPickUpObjects = true;
-      //Collect points
-      //Send header
-      sendMsgHeader(mpc_msg_type);
-      //Send data
-      boost::asio::write(serial_, boost::asio::buffer(&out_mpc[0], msgLength));
+      //Send the collected points, compact once the cortex speaks version 2
+      const mpcMessage message = mpcOut_.load();
+      const bool compact = protocolVersion_ >= 2;
+      if (compact)
+        sendFrame(&rxSends_, mpc_msg_type, message.compact, message.compactLength);
+      else
+        sendFrame(&rxSends_, mpc_msg_type, message.legacy, mpcLegacyLength);
+
+      //Version 1 has room for 3 objects, version 2 for as many as fit in a frame
+      const unsigned long dropped = message.inputCount - (compact ? message.compactCount : message.legacyCount);
+      if (dropped > 0)
+      {
+        mpcObjectsDropped_ += dropped;
+        ROS_WARN_THROTTLE(1, "robotPOS: %lu of %u mpc objects don't fit in the reply", dropped, message.inputCount);
+      }
       //Set flag
       didPickUpObjects = false;    
       return false;
       break;
     }
 
+    //The cortex answers a hello with the version it switched to, its frames after this one use it
+    case version_msg_type:
+    {
+      const int version = frame.payload[0];
+      if (version >= 1 && version <= requestedVersion_)
+      {
+        protocolVersion_ = version;
+        receiver_.setVersion(version);
+        versionAgreed_ = true;
+        ROS_INFO("robotPOS: cortex speaks protocol version %d", version);
+      }
+      else
+      {
+        ROS_WARN("robotPOS: cortex answered with protocol version %d, staying with %d", version, protocolVersion_.load());
+      }
+      return false;
+    }
+
     default:
     {
       return false;
@@ -269,71 +425,232 @@ bool robotPOS::poll(nav_msgs::Odometry *odom, sensor_msgs::Imu *imu)
     }
   }
 
-  // Fill imu message
-  constexpr float dpsToRps = 0.01745;
-  imu->angular_velocity.x = 0; //imu_.read_rot(0) * dpsToRps;
-  imu->angular_velocity.y = 0; //imu_.read_rot(1) * dpsToRps;
-  imu->angular_velocity.z = (imu_.read_rot(2) - channel2RotBias) * dpsToRps;
-  imu->angular_velocity_covariance = emptyIMUCov;
-
-  imu->linear_acceleration.y = -1* ((imu_.read_acc(0) - channel0Bias) * gravity);
-  imu->linear_acceleration.x =  (imu_.read_acc(1) - channel1Bias) * gravity;
-  imu->linear_acceleration.z =  (imu_.read_acc(2) - channel2Bias) * gravity;
-  imu->linear_acceleration_covariance = emptyIMUCov;
   return true;
 }
 
 /**
-* Callback function for sending ekf position estimate to cortex
-* STD Msg
+* Fills pose, twist and their covariances from the dead reckoning
+* @param odom Odometry message
 */
-void robotPOS::ekf_callback(const nav_msgs::Odometry::ConstPtr& in)
+void robotPOS::fillOdometry(nav_msgs::Odometry *odom) const
 {
-  const int msgLength = 13;
-  boost::array<uint8_t, msgLength> out;
-
-  static tf::TransformListener listener;
+  //Where x, y and yaw sit in the 6x6 x, y, z, roll, pitch, yaw covariances
+  constexpr int poseAxes[3] = {0, 1, 5}, twistAxes[2] = {0, 5};
+  const diffDriveOdometry &odometry = receiver_.odometry();
+
+  odom->pose.pose.position.x = odometry.x();
+  odom->pose.pose.position.y = odometry.y();
+  odom->pose.pose.position.z = 0;
+  odom->pose.pose.orientation = tf::createQuaternionMsgFromYaw(odometry.theta());
+
+  const diffDriveOdometry::poseCovariance &poseCov = odometry.getPoseCovariance();
+  odom->pose.covariance.fill(0);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      odom->pose.covariance[poseAxes[i] * 6 + poseAxes[j]] = poseCov[i * 3 + j];
+  odom->pose.covariance[2 * 6 + 2] = odom->pose.covariance[3 * 6 + 3] = odom->pose.covariance[4 * 6 + 4] = planarVariance;
+
+  odom->twist.twist.linear.x = odometry.linearVelocity();
+  odom->twist.twist.linear.y = 0;
+  odom->twist.twist.linear.z = 0;
+  odom->twist.twist.angular.x = 0;
+  odom->twist.twist.angular.y = 0;
+  odom->twist.twist.angular.z = odometry.angularVelocity();
+
+  //The wheels can't slide sideways either
+  const diffDriveOdometry::twistCovariance &twistCov = odometry.getTwistCovariance();
+  odom->twist.covariance.fill(0);
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      odom->twist.covariance[twistAxes[i] * 6 + twistAxes[j]] = twistCov[i * 2 + j];
+  for (int axis = 1; axis < 5; axis++)
+    odom->twist.covariance[axis * 6 + axis] = planarVariance;
+}
 
-  geometry_msgs::PoseStamped pose_odom;
-  geometry_msgs::PoseStamped pose_field;
-  pose_odom.pose = in->pose.pose;
-  pose_odom.header = in->header;
+/**
+* Tells the latency monitor the odometry from the last successful poll was published
+*/
+void robotPOS::odomPublished()
+{
+  latency_.mark(latencyMonitor::published);
+  latency_.frameDone();
+}
 
-  try
+/**
+* Publishes latency statistics gathered since the last call
+*/
+void robotPOS::publishDiagnostics(const ros::TimerEvent &event)
+{
+  diagnostics_.header.stamp = ros::Time::now();
+  latency_.fillDiagnostics(&diagnostics_.status[0]);
+
+  //Any frame lost since the last publish is worth a warning
+  const cortexLinkStatistics link = receiver_.getStatistics();
+  const unsigned long missed = receiver_.getMissedFrames(), dropped = txDropped_;
+  const unsigned long problems = link.corrupt + link.unknownType + missed + dropped;
+  const std::pair<const char*, unsigned long> linkValues[] =
   {
-    pose_odom.header.stamp = ros::Time(0);
-    //listener.waitForTransform("odom", "field", in->header.stamp, ros::Duration(3.0));
-    listener.transformPose("field", pose_odom, pose_field);
-  }
-  catch (const tf2::ExtrapolationException& e)
+    {"protocol version", protocolVersion_.load()}, {"frames", link.frames}, {"corrupt", link.corrupt},
+    {"unknown type", link.unknownType}, {"missed", missed}, {"resyncs", link.resyncs},
+    {"skipped bytes", link.skippedBytes}, {"send dropped", dropped}, {"poses sent", posesSent_},
+    {"poses superseded", posesSuperseded_}, {"mpc objects dropped", mpcObjectsDropped_.load()}
+  };
+
+  diagnostic_msgs::DiagnosticStatus &linkStatus = diagnostics_.status[1];
+  linkStatus.name = "robot_driver: cortex link";
+  linkStatus.level = problems > linkProblems_ ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+  linkStatus.message = problems > linkProblems_ ? "losing frames" : "ok";
+  if (!failure_.empty())
   {
-    ROS_INFO("robotPOS: ekf_callback: Need to see the past");
-    return;
+    linkStatus.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+    linkStatus.message = failure_;
   }
-  catch (const tf2::ConnectivityException& e)
+  linkStatus.values.resize(sizeof(linkValues) / sizeof(linkValues[0]));
+  for (size_t i = 0; i < linkStatus.values.size(); i++)
   {
-    ROS_INFO("robotPOS: ekf_callback: Need more data for transform");
-    return;
+    linkStatus.values[i].key = linkValues[i].first;
+    linkStatus.values[i].value = std::to_string(linkValues[i].second);
   }
-  catch (const tf2::LookupException& e)
+  linkProblems_ = problems;
+
+  //Samples overwritten on the chip before they were read, or dropped before they were published
+  const unsigned long imuMissed = imu_.getMissedSamples(), imuOverruns = imu_.getOverruns();
+  diagnostic_msgs::DiagnosticStatus &imuStatus = diagnostics_.status[2];
+  imuStatus.name = "robot_driver: imu";
+  imuStatus.level = imuMissed + imuOverruns > imuProblems_ ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+  imuStatus.message = imuMissed + imuOverruns > imuProblems_ ? "losing samples" : "ok";
+  imuStatus.values.resize(2);
+  imuStatus.values[0].key = "missed samples";
+  imuStatus.values[0].value = std::to_string(imuMissed);
+  imuStatus.values[1].key = "overruns";
+  imuStatus.values[1].value = std::to_string(imuOverruns);
+  imuProblems_ = imuMissed + imuOverruns;
+
+  if (recorder_.isOpen())
   {
-    ROS_INFO("robotPOS: ekf_callback: Can't find frame");
+    diagnostic_msgs::DiagnosticStatus &status = diagnostics_.status[3];
+    const unsigned long dropped = recorder_.getDropped();
+
+    status.name = "robot_driver: flight recorder";
+    status.level = dropped > 0 ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = dropped > 0 ? "dropping records" : "recording";
+    status.values.resize(2);
+    status.values[0].key = "written";
+    status.values[0].value = std::to_string(recorder_.getWritten());
+    status.values[1].key = "dropped";
+    status.values[1].value = std::to_string(dropped);
+  }
+
+  diagnosticsPub_.publish(diagnostics_);
+}
+
+/**
+* Takes the oldest IMU sample the sampling thread has queued
+* @param  imu IMU message to fill
+* @return     False if no sample is waiting
+*/
+bool robotPOS::popImu(sensor_msgs::Imu *imu)
+{
+  imuSample sample;
+
+  if (!imu_.pop(&sample))
+    return false;
+
+  imu_.fillImu(sample, imu);
+  return true;
+}
+
+/**
+* Takes what the IMU measured over the frame from the last successful poll
+* @param  imu IMU message to fill, stamped like the odometry
+* @return     False if no sample arrived during the frame, or it was already taken
+*/
+bool robotPOS::popFrameImu(sensor_msgs::Imu *imu)
+{
+  imuPreintegration frameImu;
+  if (!receiver_.takeFrameImu(&frameImu))
+    return false;
+
+  imu->header.stamp = frameImuStamp_;
+
+  //No orientation, and only the yaw rate is measured
+  imu->orientation_covariance.fill(0);
+  imu->orientation_covariance[0] = -1;
+
+  imu->angular_velocity.x = 0;
+  imu->angular_velocity.y = 0;
+  imu->angular_velocity.z = frameImu.yawRate;
+  imu->angular_velocity_covariance.fill(0);
+  imu->angular_velocity_covariance[8] = frameImu.yawRateVariance;
+
+  imu->linear_acceleration.x = frameImu.acc[0];
+  imu->linear_acceleration.y = frameImu.acc[1];
+  imu->linear_acceleration.z = frameImu.acc[2];
+  std::copy(frameImu.accCovariance.begin(), frameImu.accCovariance.end(), imu->linear_acceleration_covariance.begin());
+  return true;
+}
+
+/**
+* Callback function for the ekf position estimate, keeps it for forwardPose to send to the cortex
+*/
+void robotPOS::ekf_callback(const nav_msgs::Odometry::ConstPtr& in)
+{
+  //The cortex only wants the newest pose, one it hasn't been sent yet is stale now
+  if (havePose_)
+    posesSuperseded_++;
+
+  pendingPose_.header = in->header;
+  pendingPose_.pose = in->pose.pose;
+  havePose_ = true;
+}
+
+/**
+* Sends the latest ekf pose to the cortex in the field frame, once the last message has left
+* STD Msg
+*/
+void robotPOS::forwardPose(const ros::TimerEvent &event)
+{
+  //While the UART is busy the pose can still be superseded by a newer one
+  if (!havePose_ || txPending_ > 0)
     return;
+
+  if (!haveField_ || !fieldStatic_)
+  {
+    try
+    {
+      listener_.lookupTransform("field", pendingPose_.header.frame_id, ros::Time(0), field_);
+      haveField_ = true;
+    }
+    catch (const tf::TransformException& e)
+    {
+      ROS_INFO_THROTTLE(1, "robotPOS: forwardPose: Need more data for transform: %s", e.what());
+      return;
+    }
   }
 
-  conv.l = (int32_t)(pose_field.pose.position.x * 1000);
+  tf::Pose pose;
+  tf::poseMsgToTF(pendingPose_.pose, pose);
+  pose = field_ * pose;
+  havePose_ = false;
+  fieldX_ = pose.getOrigin().x();
+  fieldY_ = pose.getOrigin().y();
+
+  const int msgLength = 13;
+  boost::array<uint8_t, msgLength> out;
+
+  conv.l = (int32_t)(pose.getOrigin().x() * 1000);
   out[0] = conv.b[0];
   out[1] = conv.b[1];
   out[2] = conv.b[2];
   out[3] = conv.b[3];
 
-  conv.l = (int32_t)(pose_field.pose.position.y * 1000);
+  conv.l = (int32_t)(pose.getOrigin().y() * 1000);
   out[4] = conv.b[0];
   out[5] = conv.b[1];
   out[6] = conv.b[2];
   out[7] = conv.b[3];
 
-  conv.l = (int32_t)(tf::getYaw(pose_field.pose.orientation) * 57.2957795);
+  conv.l = (int32_t)(tf::getYaw(pose.getRotation()) * 57.2957795);
   out[8] = conv.b[0];
   out[9] = conv.b[1];
   out[10] = conv.b[2];
@@ -342,11 +659,8 @@ void robotPOS::ekf_callback(const nav_msgs::Odometry::ConstPtr& in)
   out[12] = int(currentLidarRPM / 2);
   currentLidarRPM = 0;
 
-  //Send header
-  sendMsgHeader(std_msg_type);
-
-  //Send data
-  boost::asio::write(serial_,  boost::asio::buffer(&out[0], msgLength));
+  sendFrame(&callbackSends_, std_msg_type, &out[0], msgLength);
+  posesSent_++;
 }
 
 /**
@@ -355,26 +669,22 @@ void robotPOS::ekf_callback(const nav_msgs::Odometry::ConstPtr& in)
 */
 void robotPOS::mpc_callback(const sensor_msgs::PointCloud::ConstPtr& in)
 {
+  //Encode here so the cortex's request is answered without converting anything
+  const int count = std::min(int(in->points.size()), mpcMaxObjects);
+  mpcObject objects[mpcMaxObjects];
+  for (int i = 0; i < count; i++)
+  {
+    objects[i].x = in->points[i].x;
+    objects[i].y = in->points[i].y;
+    objects[i].kind = static_cast<uint8_t>(int(in->points[i].z));
+  }
 
- // Only tell the robot to get more objects if it isn't busy
-  std::fill(out_mpc.begin(), out_mpc.end(), 255);
-
-  
-    for(int index = 0; index < in->points.size(); index++)
-    {
-//      ROS_INFO("generating msg %d", index);
-
-      //Convert num to 4 bytes
-      conv.l = in->points.at(index).x * 1000;
-      for (int i = 0; i < 4; i++)
-        out_mpc.at(i + index * 9) = conv.b[i];
-
-      conv.l = in->points.at(index).y * 1000;
-      for (int i = 0; i < 4; i++)
-        out_mpc.at(4 + i + index * 9) = conv.b[i];
-
-      out_mpc.at(8 + index * 9) = in->points.at(index).z;
-      }
+  //Positions are relative to where the cortex was last told the robot is
+  //Objects past mpcMaxObjects fit in no encoding, they count as dropped with the rest
+  mpcMessage message;
+  encodeMpcMessage(objects, count, fieldX_, fieldY_, &message);
+  message.inputCount = in->points.size();
+  mpcOut_.store(message);
 }
 
 void robotPOS::lidarRPM_callback(const std_msgs::UInt16::ConstPtr& in)
@@ -397,6 +707,9 @@ inline const uint8_t robotPOS::getMsgLengthForType(const uint8_t type) const
     case mpc_msg_type:
     return mpc_msg_length;
 
+    case version_msg_type:
+    return version_msg_length;
+
     default:
     ROS_INFO("robotPOS: Got bad msg type: %d", unsigned(type));
     return 0;
@@ -404,44 +717,136 @@ inline const uint8_t robotPOS::getMsgLengthForType(const uint8_t type) const
 }
 
 /**
-* Sends message header over UART
-* @param type Type of message
+* Offers the cortex the newest protocol version, until it answers or enough attempts went unanswered
 */
-void robotPOS::sendMsgHeader(const uint8_t type)
+void robotPOS::sendHello(const ros::TimerEvent &event)
 {
-  //Send start byte
-  boost::asio::write(serial_, boost::asio::buffer(&startFlag[0], 1));
+  if (versionAgreed_)
+  {
+    helloTimer_.stop();
+    return;
+  }
 
-  //Send type byte
-  boost::asio::write(serial_, boost::asio::buffer(&msgTypes[type - 1], 1));
+  if (hellosSent_++ == helloAttempts)
+  {
+    ROS_WARN("robotPOS: cortex didn't answer the protocol hello, staying with protocol version %d", protocolVersion_.load());
+    helloTimer_.stop();
+    return;
+  }
 
-  //Send count
-  msgCounts[type - 1] = msgCounts[type - 1] + 1 >= 255 ? 0 : msgCounts[type - 1] + 1;
-  boost::asio::write(serial_, boost::asio::buffer(&msgCounts[type - 1], 1));
+  const uint8_t version = requestedVersion_;
+  sendFrame(&callbackSends_, version_msg_type, &version, version_msg_length);
 }
 
 /**
-* Verifies a message header
-* @param  type  Message type
-* @param  count Message count
-* @return       If header is valid
+* Hands a message for the cortex to the TX thread
+* @param queue   The calling thread's queue
+* @param type    Type of message
+* @param payload Payload bytes
+* @param length  Number of payload bytes
 */
-inline const bool robotPOS::verifyMsgHeader(const uint8_t type, const uint8_t count)
+void robotPOS::sendFrame(txRing *queue, const uint8_t type, const uint8_t *payload, const size_t length)
 {
-  if (type > 0 && type < 3)
+  if (replaying_)
+    return;
+
+  txMessage message;
+  message.type = type;
+  message.length = length;
+  std::copy(payload, payload + length, message.payload.begin());
+
+  //Counted before the push, a drain already posted could write it and subtract it first
+  txPending_++;
+
+  //The cortex stopped reading, newer messages are no use either until it drains
+  if (!queue->push(message))
   {
-    if (isFirstMsg)
-    {
-      msgCounts[type] = count;
-      isFirstMsg = false;
-      return true;
-    }
-    else if (count == (msgCounts[type] + 1 >= 0xFF ? 0 : msgCounts[type] + 1))
-    {
-      msgCounts[type] = count;
-      return true;
-    }
+    txPending_--;
+    txDropped_++;
+    return;
   }
 
-  return false;
+  txIo_.post(boost::bind(&robotPOS::drainSends, this));
+}
+
+/**
+* TX thread main loop, runs txIo_ until the driver shuts down
+*/
+void robotPOS::runTx()
+{
+  try
+  {
+    txIo_.run();
+  }
+  catch (const boost::system::system_error &e)
+  {
+    //The driver decides what a dead link means, wake the RX thread so it sees it
+    txError_ = e.what();
+    txFailed_.store(true, std::memory_order_release);
+    rxIo_.post([] {});
+  }
+}
+
+/**
+* Frames queued messages into free slots and starts writing them unless a write is in flight
+*/
+void robotPOS::drainSends()
+{
+  //Answers to the cortex's requests go first, it is waiting on them
+  txMessage message;
+  while (txHead_ - txTail_ < txQueueSize && (rxSends_.pop(&message) || callbackSends_.pop(&message)))
+  {
+    const uint8_t type = message.type;
+    const int version = protocolVersion_;
+
+    //Counts wrap after 254 like the original firmware's, after 255 under version 2 like the cortex's
+    const int modulus = version > 1 ? 256 : 255;
+    msgCounts[type - 1] = (msgCounts[type - 1] + 1) % modulus;
+
+    txSlot &slot = txQueue_[txHead_ % txQueueSize];
+    slot.length = buildCortexFrame(type, msgCounts[type - 1], &message.payload[0], message.length, version,
+                                   &slot.data[0]);
+    txHead_++;
+  }
+
+  if (txWriting_ == 0 && txTail_ != txHead_)
+    startWrite();
+}
+
+/**
+* Writes every framed message with one gather write
+*/
+void robotPOS::startWrite()
+{
+  txBuffers_.clear();
+  for (uint64_t i = txTail_; i != txHead_; i++)
+  {
+    const txSlot &slot = txQueue_[i % txQueueSize];
+    txBuffers_.push_back(boost::asio::buffer(&slot.data[0], slot.length));
+  }
+
+  txWriting_ = txBuffers_.size();
+  boost::asio::async_write(txPort_, txBuffers_,
+    boost::bind(&robotPOS::writeHandler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+/**
+* Called by the io_service when a write completes
+* @param error            Write error
+* @param bytesTransferred Number of bytes written
+*/
+void robotPOS::writeHandler(const boost::system::error_code &error, const size_t bytesTransferred)
+{
+  if (error)
+  {
+    if (error != boost::asio::error::operation_aborted)
+      throw boost::system::system_error(error);
+    return;
+  }
+
+  txPending_ -= txWriting_;
+  txTail_ += txWriting_;
+  txWriting_ = 0;
+
+  drainSends();
 }
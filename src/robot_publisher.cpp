@@ -33,121 +33,36 @@
 *********************************************************************/
 
 #include <ros/ros.h>
-#include <geometry_msgs/PoseStamped.h>
-#include <geometry_msgs/PoseWithCovarianceStamped.h>
-#include <tf/transform_broadcaster.h>
 #include <boost/asio.hpp>
-#include <std_msgs/UInt16.h>
-#include <nav_msgs/Odometry.h>
-#include <sensor_msgs/Imu.h>
-#include <iostream>
-#include <sensor_msgs/PointCloud2.h>
+#include <stdexcept>
 
-#include "robot_driver/robotPOS.h"
-#include "robot_driver/MPU6000.h"
+#include "robot_driver/robotDriver.h"
 
+//Standalone robot_driver node, the robot_driver/driver nodelet hosts the same robotDriver
 int main(int argc, char **argv)
 {
   ros::init(argc, argv, "robot_publisher");
   ros::NodeHandle n;
-  ros::NodeHandle priv_nh("~");
-  tf::TransformBroadcaster br;
-  std::string port;
-  int baud_rate;
-  std::string frame_id;
-
-  n.getParam("/robot_driver/port", port);
-  n.getParam("/robot_driver/baud_rate", baud_rate);
-  n.getParam("/robot_driver/frame_id", frame_id);
-  ROS_INFO("Running with port: %s and baud rate: %d", port.c_str(), baud_rate);
-
-  boost::asio::io_service io;
-  tf::Transform transform;
-
-  ros::Publisher filterFix = n.advertise<geometry_msgs::PoseWithCovarianceStamped>("set_pose", 10);
 
   try
   {
-    robotPOS robot(port, baud_rate, io, 0, 500000);
-
-    ros::Publisher odomPub = n.advertise<nav_msgs::Odometry>("robot_publisher/odom0", 1000),
-    imuPub = n.advertise<sensor_msgs::Imu>("robot_publisher/imu0", 1000);
-
-    nav_msgs::Odometry odomOut;
-    sensor_msgs::Imu imuOut;
-
-    odomOut.header.frame_id = "odom";
-    odomOut.child_frame_id = "base_link";
-    odomOut.twist.twist.linear.x = 0;
-    odomOut.twist.twist.linear.y = 0;
-    odomOut.twist.twist.linear.z = 0;
-    odomOut.twist.twist.angular.x = 0;
-    odomOut.twist.twist.angular.y = 0;
-    odomOut.twist.twist.angular.z = 0;
-    odomOut.pose.pose.position.x = 0;
-    odomOut.pose.pose.position.y = 0;
-    odomOut.pose.pose.position.z = 0;
-    odomOut.pose.pose.orientation = tf::createQuaternionMsgFromYaw(0);
-
-    imuOut.header.frame_id = "base_link";
-    imuOut.angular_velocity.x = 0;
-    imuOut.angular_velocity.y = 0;
-    imuOut.angular_velocity.z = 0;
-    imuOut.linear_acceleration.y = 0;
-    imuOut.linear_acceleration.x = 0;
-    imuOut.linear_acceleration.z = 0;
-
-    odomPub.publish(odomOut);
-    imuPub.publish(imuOut);
+    robotDriver driver(n);
 
-	bool firstPub = true;
+    //A finished replay or a failed serial link ends the node
+    while (ros::ok() && !driver.isDone())
+      ros::WallDuration(0.1).sleep();
 
-    while (ros::ok())
-    {
-      odomOut.header.stamp = ros::Time::now();
-      imuOut.header.stamp = ros::Time::now();
-
-      if(robot.poll(&odomOut, &imuOut)){
-        //ROS_INFO("not skipped");
-        odomPub.publish(odomOut);
-        imuPub.publish(imuOut);
-      }else{
-        //ROS_INFO("skipped");
-    	}
-
-	if (firstPub)
-	{
-		geometry_msgs::PoseWithCovarianceStamped msg;
-		msg.header.stamp = ros::Time::now();
-		msg.pose.pose.position.x = 0;
-		msg.pose.pose.position.y = 0;
-		msg.pose.pose.position.z = 0;
-		msg.pose.pose.orientation.x = 0;
-		msg.pose.pose.orientation.y = 0;
-		msg.pose.pose.orientation.z = 0;
-		msg.pose.pose.orientation.w = 1;
-		const boost::array<float, 36> cov =
-			{{
-			  1e-6, 0,    0,    0,    0,    0,
-			  0,    1e-6, 0,    0,    0,    0,
-			  0,    0,    1e-6, 0,    0,    0,
-			  0,    0,    0,    1e-6, 0,    0,
-			  0,    0,    0,    0,    1e-6, 0,
-			  0,    0,    0,    0,    0,    1e-6
-			}};
-		msg.pose.covariance = cov;
-		filterFix.publish(msg);
-		firstPub = false;
-	}
-
-      ros::spinOnce();
-    }
-
-    return 0;
+    driver.stop();
+    return driver.failed() ? -1 : 0;
   }
   catch (boost::system::system_error ex)
   {
     ROS_ERROR("robot_driver: Error instantiating robot object. Are you sure you have the correct port and baud rate? Error was: %s", ex.what());
     return -1;
   }
+  catch (const std::invalid_argument &ex)
+  {
+    ROS_ERROR("robot_driver: Bad parameter: %s", ex.what());
+    return -1;
+  }
 }
@@ -0,0 +1,31 @@
+#include <stdexcept>
+
+#include "robot_driver/spiTransport.h"
+#include "robot_driver/spidevTransport.h"
+#include "robot_driver/mpu6000Sim.h"
+#ifdef ROBOT_DRIVER_HAVE_WIRINGPI
+#include "robot_driver/wiringPiTransport.h"
+#endif
+
+/**
+* Creates an SPI backend
+* @param  backend "spidev", "wiringpi" (when built with WiringPi) or "sim" for the in-memory MPU6000
+* @param  channel Chip select channel
+* @param  speed   Clock speed in Hz
+* @return         The backend
+*/
+std::unique_ptr<spiTransport> createSpiTransport(const std::string &backend, const int channel, const long speed)
+{
+  if (backend == "spidev")
+    return std::unique_ptr<spiTransport>(new spidevTransport(channel, speed));
+
+#ifdef ROBOT_DRIVER_HAVE_WIRINGPI
+  if (backend == "wiringpi")
+    return std::unique_ptr<spiTransport>(new wiringPiTransport(channel, speed));
+#endif
+
+  if (backend == "sim")
+    return std::unique_ptr<spiTransport>(new mpu6000Sim());
+
+  throw std::invalid_argument("createSpiTransport: unknown SPI backend " + backend);
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <boost/system/system_error.hpp>
+
+#include "robot_driver/spidevTransport.h"
+
+//std::min takes it by reference, so it needs storage
+const size_t spidevTransport::maxSegmentsPerMessage;
+
+spidevTransport::spidevTransport(const int channel, const long speed):
+speed_(speed)
+{
+  const std::string device = "/dev/spidev0." + std::to_string(channel);
+
+  fd_ = open(device.c_str(), O_RDWR);
+  if (fd_ < 0)
+    throw boost::system::system_error(errno, boost::system::system_category(), "spidevTransport: can't open " + device);
+
+  uint8_t mode = SPI_MODE_0, bits = 8;
+
+  if (ioctl(fd_, SPI_IOC_WR_MODE, &mode) < 0 ||
+      ioctl(fd_, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+      ioctl(fd_, SPI_IOC_WR_MAX_SPEED_HZ, &speed_) < 0)
+  {
+    const int error = errno;
+    close(fd_);
+    throw boost::system::system_error(error, boost::system::system_category(), "spidevTransport: can't configure " + device);
+  }
+}
+
+spidevTransport::~spidevTransport()
+{
+  close(fd_);
+}
+
+/**
+* One transaction with chip select held for its whole length
+* @param data   Bytes to send, replaced by the bytes received
+* @param length Number of bytes
+*/
+void spidevTransport::transfer(uint8_t *data, const size_t length)
+{
+  spiSegment segment = {data, length};
+  transfer(&segment, 1);
+}
+
+/**
+* Several transactions queued in as few ioctls as possible
+* @param segments Transactions in order
+* @param count    Number of transactions
+*/
+void spidevTransport::transfer(spiSegment *segments, const size_t count)
+{
+  spi_ioc_transfer transfers[maxSegmentsPerMessage];
+
+  for (size_t first = 0; first < count; first += maxSegmentsPerMessage)
+  {
+    const size_t batch = std::min(count - first, maxSegmentsPerMessage);
+    std::memset(transfers, 0, sizeof(spi_ioc_transfer) * batch);
+
+    for (size_t i = 0; i < batch; i++)
+    {
+      transfers[i].tx_buf = reinterpret_cast<uintptr_t>(segments[first + i].data);
+      transfers[i].rx_buf = reinterpret_cast<uintptr_t>(segments[first + i].data);
+      transfers[i].len = segments[first + i].length;
+      transfers[i].speed_hz = speed_;
+      transfers[i].bits_per_word = 8;
+
+      //Release chip select between segments, the last one releases it anyway
+      transfers[i].cs_change = i + 1 < batch;
+    }
+
+    if (ioctl(fd_, SPI_IOC_MESSAGE(batch), transfers) < 0)
+      throw boost::system::system_error(errno, boost::system::system_category(), "spidevTransport: transfer failed");
+  }
+}
@@ -0,0 +1,19 @@
+#include <wiringPiSPI.h>
+
+#include "robot_driver/wiringPiTransport.h"
+
+wiringPiTransport::wiringPiTransport(const int channel, const long speed):
+channel_(channel)
+{
+  wiringPiSPISetup(channel_, speed);
+}
+
+/**
+* One transaction with chip select held for its whole length
+* @param data   Bytes to send, replaced by the bytes received
+* @param length Number of bytes
+*/
+void wiringPiTransport::transfer(uint8_t *data, const size_t length)
+{
+  wiringPiSPIDataRW(channel_, data, length);
+}